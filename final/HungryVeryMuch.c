@@ -4,13 +4,24 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <signal.h>
-#include <pthread.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/epoll.h>
+
+#include "protocol.h"
+#include "histogram.h"
 
 #define SERVER_READ_BUFFER_SIZE 1024
+#define ORDERS_PER_FRAME 64
+#define MAX_CUSTOMERS 1000000
+#define MAX_CONNECTIONS 1024
+#define MAX_EVENTS 64
+#define DEFAULT_MAX_RETRIES 3
 
 int sentOrders = 0;
-int ordersCancelled = 0;
+volatile sig_atomic_t ordersCancelled = 0;
 
 void sigintHandler(int signal)
 {
@@ -23,6 +34,399 @@ void sigintHandler(int signal)
     printf("Orders cancelled\n");
 }
 
+// One connection to the shop, it gets every connectionCount'th order
+typedef struct
+{
+    int socket;
+    int index;
+    char *outbox;
+    int outboxed;
+    int outboxCapacity;
+    char inbox[SERVER_READ_BUFFER_SIZE];
+    int inboxed;
+    int total;
+    int submitted;
+    int sent;      // order records sent, retries included
+    int delivered;
+    int abandoned; // turned away more than maxRetries times
+    int ended;
+    int writable;
+    int done;
+} Connection;
+
+Connection *connections;
+int connectionCount = 1;
+int numberOfCustomers;
+int *positions;
+long long *submitTimes;
+int epollFd;
+int quiet = 0;
+int finishedConnections = 0;
+int failedConnections = 0;
+int deliveredOrders = 0;
+Histogram latency;
+
+// Orders the shop turned away wait here until the retry time it gave, earliest on top
+typedef struct
+{
+    long long due;
+    int customer;
+} Retry;
+
+Retry *retryHeap;
+int retryCount = 0;
+int *retries;
+int maxRetries = DEFAULT_MAX_RETRIES;
+int busyReplies = 0;
+int abandonedOrders = 0;
+
+long long currentMicros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int appendFrame(Connection *connection, int type, const char *payload, int length)
+{
+    int needed = connection->outboxed + FRAME_HEADER_SIZE + length;
+    if (needed > connection->outboxCapacity)
+    {
+        int capacity = connection->outboxCapacity * 2;
+        while (capacity < needed)
+        {
+            capacity *= 2;
+        }
+        char *outbox = realloc(connection->outbox, capacity);
+        if (outbox == NULL)
+        {
+            perror("realloc");
+            return -1;
+        }
+        connection->outbox = outbox;
+        connection->outboxCapacity = capacity;
+    }
+    encodeFrameHeader(connection->outbox + connection->outboxed, type, length);
+    if (length > 0)
+    {
+        memcpy(connection->outbox + connection->outboxed + FRAME_HEADER_SIZE, payload, length);
+    }
+    connection->outboxed = needed;
+    return 0;
+}
+
+void finishConnection(Connection *connection, int failed)
+{
+    if (connection->done)
+    {
+        return;
+    }
+    connection->done = 1;
+    finishedConnections++;
+    failedConnections += failed;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->socket, NULL);
+    close(connection->socket);
+}
+
+void flushConnection(Connection *connection)
+{
+    while (!connection->done && connection->outboxed > 0)
+    {
+        int written = send(connection->socket, connection->outbox, connection->outboxed, MSG_NOSIGNAL);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            printf("Shop burned down\n");
+            finishConnection(connection, 1);
+            return;
+        }
+        memmove(connection->outbox, connection->outbox + written, connection->outboxed - written);
+        connection->outboxed -= written;
+    }
+
+    int writable = connection->outboxed > 0;
+    if (!connection->done && writable != connection->writable)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+        event.data.ptr = connection;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection->socket, &event);
+        connection->writable = writable;
+    }
+}
+
+void pushRetry(long long due, int customer)
+{
+    int i = retryCount++;
+    while (i > 0 && retryHeap[(i - 1) / 2].due > due)
+    {
+        retryHeap[i] = retryHeap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    retryHeap[i].due = due;
+    retryHeap[i].customer = customer;
+}
+
+int popRetry()
+{
+    int customer = retryHeap[0].customer;
+    Retry last = retryHeap[--retryCount];
+    int i = 0;
+    while (2 * i + 1 < retryCount)
+    {
+        int child = 2 * i + 1;
+        if (child + 1 < retryCount && retryHeap[child + 1].due < retryHeap[child].due)
+        {
+            child++;
+        }
+        if (last.due <= retryHeap[child].due)
+        {
+            break;
+        }
+        retryHeap[i] = retryHeap[child];
+        i = child;
+    }
+    retryHeap[i] = last;
+    return customer;
+}
+
+void encodeOrder(char *record, int customer)
+{
+    encodeInt(record + 0, customer);
+    encodeInt(record + 4, positions[2 * customer + 0]);
+    encodeInt(record + 8, positions[2 * customer + 1]);
+}
+
+// The end frame waits until every order is delivered or abandoned, an order
+// turned away later could not be sent again after it
+void endIfComplete(Connection *connection)
+{
+    if (connection->ended || connection->submitted < connection->total || connection->delivered + connection->abandoned < connection->total)
+    {
+        return;
+    }
+    char payload[COUNT_PAYLOAD_SIZE];
+    encodeInt(payload, connection->sent);
+    appendFrame(connection, FRAME_END, payload, sizeof(payload));
+    connection->ended = 1;
+}
+
+// Queues the next count orders of the connection, submitTime is when they were due
+void submitOrders(Connection *connection, int count, long long submitTime)
+{
+    char payload[ORDERS_PER_FRAME * ORDER_RECORD_SIZE];
+    while (count > 0 && connection->submitted < connection->total)
+    {
+        int records = 0;
+        while (records < ORDERS_PER_FRAME && records < count && connection->submitted < connection->total)
+        {
+            int customer = connection->index + connection->submitted * connectionCount;
+            encodeOrder(payload + records * ORDER_RECORD_SIZE, customer);
+            submitTimes[customer] = submitTime;
+            if (!quiet)
+            {
+                printf("Put order from customer %d at position (%d, %d) in queue\n", customer, positions[2 * customer + 0], positions[2 * customer + 1]);
+            }
+            connection->submitted++;
+            records++;
+        }
+        appendFrame(connection, FRAME_ORDERS, payload, records * ORDER_RECORD_SIZE);
+        connection->sent += records;
+        count -= records;
+    }
+
+    endIfComplete(connection);
+    flushConnection(connection);
+}
+
+// Sends the orders whose retry time has come, latency still counts from their first submission
+void resubmitOrders(long long now)
+{
+    while (retryCount > 0 && retryHeap[0].due <= now)
+    {
+        int customer = popRetry();
+        Connection *connection = &connections[customer % connectionCount];
+        if (connection->done)
+        {
+            continue;
+        }
+        char record[ORDER_RECORD_SIZE];
+        encodeOrder(record, customer);
+        appendFrame(connection, FRAME_ORDERS, record, sizeof(record));
+        connection->sent++;
+        flushConnection(connection);
+    }
+}
+
+// Busy records either refuse the connection or turn one order away for a while.
+// Returns 1 for an abandoned order.
+int takeBusy(Connection *connection, int customer, int retryAfter, long long now)
+{
+    busyReplies++;
+    if (customer == NO_CUSTOMER)
+    {
+        printf("Shop is busy, retry after %d ms\n", retryAfter);
+        finishConnection(connection, 1);
+        return 0;
+    }
+    if (customer < 0 || customer >= numberOfCustomers)
+    {
+        return 0;
+    }
+
+    if (retries[customer] >= maxRetries)
+    {
+        if (!quiet)
+        {
+            printf("Gave up on the order for customer %d\n", customer);
+        }
+        connection->abandoned++;
+        abandonedOrders++;
+        endIfComplete(connection);
+        return 1;
+    }
+    if (!quiet)
+    {
+        printf("Shop is busy, order for customer %d again in %d ms\n", customer, retryAfter);
+    }
+    // Spread over up to twice the retry time so turned away orders do not all come back at once
+    retries[customer]++;
+    pushRetry(now + (long long)(retryAfter * 1000LL * (1 + drand48())), customer);
+    return 0;
+}
+
+// Returns the number of orders delivered or abandoned by the frames read
+int readConnection(Connection *connection)
+{
+    int delivered = 0;
+    int completed = 0;
+    while (!connection->done)
+    {
+        int bytesRead = read(connection->socket, connection->inbox + connection->inboxed, sizeof(connection->inbox) - connection->inboxed);
+        if (bytesRead == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (bytesRead <= 0)
+        {
+            printf("Shop burned down\n");
+            finishConnection(connection, 1);
+            break;
+        }
+
+        // Frames are decoded as they arrive, a frame may span several reads
+        connection->inboxed += bytesRead;
+        int offset = 0;
+        long long now = currentMicros();
+        while (connection->inboxed - offset >= FRAME_HEADER_SIZE)
+        {
+            FrameHeader header;
+            decodeFrameHeader(connection->inbox + offset, &header);
+            if (!isValidFrame(&header, 0) || header.length > sizeof(connection->inbox) - FRAME_HEADER_SIZE)
+            {
+                fprintf(stderr, "Shop sent an invalid frame\n");
+                finishConnection(connection, 1);
+                break;
+            }
+            if (connection->inboxed - offset < FRAME_HEADER_SIZE + (int)header.length)
+            {
+                break;
+            }
+
+            char *payload = connection->inbox + offset + FRAME_HEADER_SIZE;
+            if (header.type == FRAME_ACK && !quiet)
+            {
+                printf("Shop took %d orders\n", decodeInt(payload));
+            }
+            else if (header.type == FRAME_DELIVERED)
+            {
+                for (uint32_t i = 0; i < header.length; i += DELIVERED_RECORD_SIZE)
+                {
+                    int customer = decodeInt(payload + i);
+                    if (customer >= 0 && customer < numberOfCustomers)
+                    {
+                        histogramRecord(&latency, now - submitTimes[customer]);
+                    }
+                    if (!quiet)
+                    {
+                        printf("Order for customer %d is delivered\n", customer);
+                    }
+                    connection->delivered++;
+                    delivered++;
+                }
+                endIfComplete(connection);
+            }
+            else if (header.type == FRAME_BUSY)
+            {
+                for (uint32_t i = 0; i < header.length && !connection->done; i += BUSY_RECORD_SIZE)
+                {
+                    completed += takeBusy(connection, decodeInt(payload + i), decodeInt(payload + i + 4), now);
+                }
+                if (connection->done)
+                {
+                    break;
+                }
+            }
+            else if (header.type == FRAME_DONE)
+            {
+                if (!quiet)
+                {
+                    printf("Thank you for your order\n");
+                }
+                finishConnection(connection, 0);
+                break;
+            }
+            offset += FRAME_HEADER_SIZE + header.length;
+        }
+        memmove(connection->inbox, connection->inbox + offset, connection->inboxed - offset);
+        connection->inboxed -= offset;
+        flushConnection(connection);
+    }
+    deliveredOrders += delivered;
+    return delivered + completed;
+}
+
+void cancelOrders()
+{
+    for (int i = 0; i < connectionCount; i++)
+    {
+        Connection *connection = &connections[i];
+        if (connection->done)
+        {
+            continue;
+        }
+
+        // Frames already queued go out first so the cancel lands on a frame boundary
+        appendFrame(connection, FRAME_CANCEL, NULL, 0);
+        fcntl(connection->socket, F_SETFL, fcntl(connection->socket, F_GETFL) & ~O_NONBLOCK);
+        flushConnection(connection);
+        finishConnection(connection, 0);
+    }
+}
+
+void printUsage(char *program)
+{
+    fprintf(stderr, "Usage: %s [-c connections] [-r rate | -w window] [-R retries] [-a address] [-s seed] [-q] [port] [numberOfCustomers] [p] [q]\n", program);
+    fprintf(stderr, "  -c connections  concurrent connections sharing the orders (default 1)\n");
+    fprintf(stderr, "  -r rate         open loop, orders per second with Poisson arrivals\n");
+    fprintf(stderr, "  -w window       closed loop, orders in flight per connection (default all)\n");
+    fprintf(stderr, "  -R retries      times an order the shop is too busy for is sent again (default %d)\n", DEFAULT_MAX_RETRIES);
+    fprintf(stderr, "  -a address      shop address (default 127.0.0.1)\n");
+    fprintf(stderr, "  -s seed         seed for positions and arrivals (default time)\n");
+    fprintf(stderr, "  -q              only print the summary line\n");
+}
+
 int main(int argc, char *argv[])
 {
     struct sigaction sa;
@@ -35,18 +439,55 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    if (argc != 5)
+    double rate = 0;
+    int window = 0;
+    char *address = "127.0.0.1";
+    unsigned int seed = time(NULL);
+    int option;
+    while ((option = getopt(argc, argv, "c:r:w:R:a:s:q")) != -1)
+    {
+        switch (option)
+        {
+        case 'c':
+            connectionCount = atoi(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'R':
+            maxRetries = atoi(optarg);
+            break;
+        case 'a':
+            address = optarg;
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 4)
     {
-        fprintf(stderr, "Usage: %s [port] [numberOfCustomers] [p] [q]\n", argv[0]);
+        printUsage(argv[0]);
         return 1;
     }
 
-    srand(time(NULL));
+    srand(seed);
+    srand48(seed);
 
-    int port = atoi(argv[1]);
-    int numberOfCustomers = atoi(argv[2]);
-    int p = atoi(argv[3]);
-    int q = atoi(argv[4]);
+    int port = atoi(argv[optind + 0]);
+    numberOfCustomers = atoi(argv[optind + 1]);
+    int p = atoi(argv[optind + 2]);
+    int q = atoi(argv[optind + 3]);
 
     if (port < 1024 || port > 65535)
     {
@@ -54,9 +495,9 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if (numberOfCustomers < 1 || numberOfCustomers > 1024) // 1-1024
+    if (numberOfCustomers < 1 || numberOfCustomers > MAX_CUSTOMERS)
     {
-        fprintf(stderr, "Number of customers must be in range 1-1024\n");
+        fprintf(stderr, "Number of customers must be in range 1-%d\n", MAX_CUSTOMERS);
         return 1;
     }
 
@@ -72,10 +513,15 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    int connectionSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (connectionSocket == -1)
+    if (connectionCount < 1 || connectionCount > MAX_CONNECTIONS || connectionCount > numberOfCustomers)
     {
-        perror("Could not create socket");
+        fprintf(stderr, "Connections must be in range 1-%d and at most the number of customers\n", MAX_CONNECTIONS);
+        return 1;
+    }
+
+    if (rate < 0 || window < 0 || maxRetries < 0)
+    {
+        fprintf(stderr, "Rate, window and retries must not be negative\n");
         return 1;
     }
 
@@ -83,61 +529,150 @@ int main(int argc, char *argv[])
     memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_port = htons(port);
-    serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-    if (connect(connectionSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
+    if (inet_pton(AF_INET, address, &serverAddr.sin_addr) != 1)
     {
-        perror("Connect failed");
-        close(connectionSocket);
+        fprintf(stderr, "Invalid address %s\n", address);
         return 1;
     }
 
-    sentOrders = 1;
-
-    int buffer[3 * numberOfCustomers];
+    positions = malloc(2 * numberOfCustomers * sizeof(int));
+    submitTimes = malloc(numberOfCustomers * sizeof(long long));
+    connections = calloc(connectionCount, sizeof(Connection));
+    retryHeap = malloc(numberOfCustomers * sizeof(Retry));
+    retries = calloc(numberOfCustomers, sizeof(int));
+    epollFd = epoll_create1(0);
+    if (positions == NULL || submitTimes == NULL || connections == NULL || retryHeap == NULL || retries == NULL || epollFd == -1)
+    {
+        perror("Could not set up the load");
+        return 1;
+    }
     for (int i = 0; i < numberOfCustomers; i++)
     {
-        buffer[3 * i + 0] = i;
-        buffer[3 * i + 1] = rand() % p;
-        buffer[3 * i + 2] = rand() % q;
-        printf("Put order from customer %d at position (%d, %d) in queue\n", i, buffer[3 * i + 1], buffer[3 * i + 2]);
+        positions[2 * i + 0] = rand() % p;
+        positions[2 * i + 1] = rand() % q;
     }
+    initHistogram(&latency);
 
-    if (!ordersCancelled)
+    for (int i = 0; i < connectionCount; i++)
     {
-        write(connectionSocket, buffer, sizeof(buffer));
+        Connection *connection = &connections[i];
+        connection->index = i;
+        connection->total = numberOfCustomers / connectionCount + (i < numberOfCustomers % connectionCount);
+        connection->outboxCapacity = 4096;
+        connection->outbox = malloc(connection->outboxCapacity);
+        connection->socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (connection->outbox == NULL || connection->socket == -1)
+        {
+            perror("Could not create socket");
+            return 1;
+        }
+
+        if (connect(connection->socket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
+        {
+            perror("Connect failed");
+            return 1;
+        }
+        fcntl(connection->socket, F_SETFL, fcntl(connection->socket, F_GETFL) | O_NONBLOCK);
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = connection;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, connection->socket, &event);
     }
 
-    int connectionSafelyClosed = 0;
+    sentOrders = 1;
+
+    long long start = currentMicros();
 
-    char serverResponse[SERVER_READ_BUFFER_SIZE];
-    int bytesRead;
-    while (!ordersCancelled && (bytesRead = read(connectionSocket, serverResponse, sizeof(serverResponse))) > 0)
+    // Open loop submits on a Poisson schedule regardless of replies, latency is
+    // measured from the scheduled time so a slow shop cannot hide its queueing
+    int nextOrder = 0;
+    long long nextArrival = start;
+    if (rate == 0)
     {
-        for (int i = 0; i < bytesRead; i++)
+        for (int i = 0; i < connectionCount; i++)
         {
-            printf("%c", serverResponse[i]);
+            submitOrders(&connections[i], window == 0 ? connections[i].total : window, start);
         }
-        if (strcmp(serverResponse, "Thank you for your order\n") == 0)
+        nextOrder = numberOfCustomers;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (!ordersCancelled && finishedConnections < connectionCount)
+    {
+        long long now = currentMicros();
+        while (nextOrder < numberOfCustomers && nextArrival <= now)
         {
-            connectionSafelyClosed = 1;
+            submitOrders(&connections[nextOrder % connectionCount], 1, nextArrival);
+            nextOrder++;
+            nextArrival += (long long)(-log(1.0 - drand48()) / rate * 1000000);
+        }
+        resubmitOrders(now);
+
+        long long wakeUp = nextOrder < numberOfCustomers ? nextArrival : -1;
+        if (retryCount > 0 && (wakeUp == -1 || retryHeap[0].due < wakeUp))
+        {
+            wakeUp = retryHeap[0].due;
+        }
+        int timeout = wakeUp == -1 ? -1 : (int)((wakeUp - now + 999) / 1000);
+        int eventCount = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+        if (eventCount == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait");
             break;
         }
-    }
 
-    if (!ordersCancelled && (bytesRead == -1 || !connectionSafelyClosed))
-    {
-        printf("Shop burned down\n");
-        close(connectionSocket);
-        return 1;
+        for (int i = 0; i < eventCount; i++)
+        {
+            Connection *connection = events[i].data.ptr;
+            if (events[i].events & EPOLLOUT)
+            {
+                flushConnection(connection);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                int completed = readConnection(connection);
+
+                // Closed loop refills the window as orders come back, orders waiting for a retry keep their place
+                if (rate == 0 && window > 0 && completed > 0 && !connection->done)
+                {
+                    submitOrders(connection, completed, currentMicros());
+                }
+            }
+        }
     }
 
     if (ordersCancelled)
     {
-        write(connectionSocket, "CANCEL", 6);
+        cancelOrders();
+        return 0;
     }
 
-    close(connectionSocket);
+    double elapsed = (currentMicros() - start) / 1000000.0;
 
-    return 0;
+    // Single line summary for scripts, latencies are in microseconds
+    printf("{\"connections\": %d, \"orders\": %d, \"mode\": \"%s\", \"rate\": %.1f, \"window\": %d, "
+           "\"delivered\": %d, \"busy_replies\": %d, \"abandoned\": %d, \"failed_connections\": %d, \"elapsed_s\": %.3f, \"throughput\": %.1f, "
+           "\"latency_us\": {\"mean\": %.0f, \"p50\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld}}\n",
+           connectionCount, numberOfCustomers, rate > 0 ? "open" : "closed", rate, window,
+           deliveredOrders, busyReplies, abandonedOrders, failedConnections, elapsed, deliveredOrders / elapsed,
+           histogramMean(&latency), histogramPercentile(&latency, 50), histogramPercentile(&latency, 99),
+           histogramPercentile(&latency, 99.9), histogramMax(&latency));
+
+    for (int i = 0; i < connectionCount; i++)
+    {
+        free(connections[i].outbox);
+    }
+    free(connections);
+    free(retryHeap);
+    free(retries);
+    free(submitTimes);
+    free(positions);
+    close(epollFd);
+
+    return failedConnections > 0 ? 1 : 0;
 }
@@ -1,49 +1,137 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <pthread.h>
-#include <poll.h>
 #include <signal.h>
-#include <semaphore.h>
 #include <errno.h>
 #include <time.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-
-#include "circularqueue.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+#include "oven.h"
+#include "ringqueue.h"
+#include "pool.h"
+#include "logger.h"
+#include "pinv.h"
+#include "route.h"
+#include "protocol.h"
+#include "histogram.h"
+#include "stats.h"
+#include "deque.h"
+#include "affinity.h"
+#include "journal.h"
+#include "ovengroup.h"
 
 #define MAX_CLIENTS 1024
 #define BUFFER_SIZE 1024
-#define POLL_TIMEOUT 1000
+#define OUTBOX_SIZE 4096
 #define OVEN_CAPACITY 6
 #define OVEN_APARATUS 3
 #define OVEN_DOORS 2
-#define MIN_ORDER_PREPARATION_TIME 3
-#define MAX_ORDER_PREPARATION_TIME 5
 #define ORDER_OVEN_TIME 3
 #define DELIVERY_ORDER_COUNT 3
+#define ORDER_QUEUE_CAPACITY 65536
+#define MAX_EVENTS 64
+#define COOK_BATCH 8
+#define COOK_DEQUE_CAPACITY 64
+#define DEFAULT_STATS_INTERVAL 10
+#define DEFAULT_QUEUE_DEADLINE 1000
+#define DEFAULT_PREPARE_MICROS 1000
+
+// What happens to new orders once maxQueuedOrders are waiting to be prepared
+#define ADMIT_BLOCK 0    // stop reading from the client until the queue drains
+#define ADMIT_REJECT 1   // answer the new order with a busy record
+#define ADMIT_DEADLINE 2 // reject like ADMIT_REJECT, drop orders not started within queueDeadline ms
+#define ADMIT_SHED 3     // drop the oldest queued order to make room for the new one
+
+// Lifecycle timestamps kept on every order, in microseconds
+#define STAMP_RECEIVED 0
+#define STAMP_PREP_START 1
+#define STAMP_PREP_END 2
+#define STAMP_OVEN_IN 3
+#define STAMP_OVEN_OUT 4
+#define STAMP_PICKUP 5
+#define STAMP_DELIVERED 6
+#define STAMP_COUNT 7
+
+// One stage between each pair of consecutive stamps, the last one is received to delivered
+#define STAGE_COUNT STAMP_COUNT
 
 int connected = 0;
-
-int ovenFree = OVEN_CAPACITY;
-sem_t semOvenAparatus, semOvenDoors, semReadyOrders;
-pthread_mutex_t mutexOven, mutexCookedOrders, mutexDeliveredOrders, mutexInDeliveryOrders;
-pthread_mutex_t mutexOrdersWaitingForOven, mutexOrdersToBePrepared, mutexOrdersInPreparation;
+int shopOpen = 1;
+int draining = 0;
+
+// Every oven has its own slots, doors and paddles, set with -O
+OvenGroup ovens;
+OvenSpec ovenSpecs[MAX_OVENS];
+int configuredOvens = 1;
+
+// Idle threads sleep on these instead of polling
+pthread_mutex_t mutexKitchen, mutexCouriers, mutexStatus;
+pthread_cond_t condKitchen, condCouriers, condStatus;
+int statusVersion = 0;
+
+// One idle cook at a time sleeps until the next pide in the oven is done
+pthread_cond_t condOvenWatch;
+int ovenWatched = 0;
+int idleCooks = 0;
+
+// Set once by the event loop when a client cancels, every order of the client
+// points at it so whoever holds the order next drops it instead of working on it
+typedef struct
+{
+    atomic_int cancelled;
+} CancelToken;
 
 typedef struct
 {
     int socket;
     struct sockaddr_in address;
+    char buffer[BUFFER_SIZE];
+    int buffered;
+    int frameType;     // 0 between frames
+    uint32_t frameLeft; // payload bytes of the current frame not parsed yet
+    char *outbox; // grows past OUTBOX_SIZE, reading pauses until it drains below it again
+    int outboxCapacity;
+    int outboxed;
+    int receivedOrders;
+    int finishedOrders;
+    int rejectedOrders;
+    long long ackSequence; // journal record the pending ACK waits for, 0 for none
+    int ackCount;
+    long long nextAckSequence;
+    int nextAckCount;
+    int ended;
+    int cancelled;
+    CancelToken token;
+    int paused;
+    int closing;
+    uint32_t events;
+    int slot;
 } client_t;
 
+client_t *clients[MAX_CLIENTS];
+
 typedef struct
 {
     int customerId;
     int p;
     int q;
+    client_t *client;
+    CancelToken *token;
+    long long stamps[STAMP_COUNT];
+    int dropped;
+    uint64_t journalId;
 } Order;
 
 Order *order;
@@ -51,553 +139,862 @@ Order *order;
 typedef struct
 {
     Order *order;
-    time_t time;
+    long long time;
 } OrderWithTime;
 
-OrderWithTime *orderWithTime;
+// Orders are only allocated and freed by the event loop, oven entries by the
+// cooks and by the event loop when it takes cancelled orders out of the oven
+ObjectPool orderPool;
+ObjectPool ovenEntryPool;
+PoolCache frontEndCache;
+PoolCache frontEndEntryCache;
+
+// Orders recovered from the journal have no client that could cancel them
+CancelToken neverCancelled;
+
+// Hand-offs between the front end, cooks and couriers
+RingQueue orders;
+RingQueue readyOrders;
+RingQueue finishedOrders;
+// Prepared pides a cook could not push on its full oven deque, any cook loads them
+RingQueue preparedOrders;
+
+// Each cook keeps the orders it took off the orders queue and the ones it
+// prepared for the oven, idle cooks steal from the others
+typedef struct
+{
+    WorkDeque prepWork;
+    WorkDeque ovenWork;
+} CookQueues;
+
+CookQueues *cookQueues;
 
-CircularQueue orders;
-CircularQueue readyOrders;
-CircularQueue ordersInDelivery;
+// With numaLocal every cook allocates its own deques once it runs on its CPU
+int numaLocal = 0;
+pthread_barrier_t cookQueuesReady;
 
-int totalOrders = 1;
-int cookedOrders = 0;
-int ordersToBeDelivered = 0;
-int ordersWaitingForOven = 0;
-int ordersWaitingForDelivery = 0;
-int ordersToBePrepared = 0;
-int ordersInPreparation = 0;
-int deliveredOrders = 0;
-int ordersInDeliveryCount = 0;
+// Pools without a CPU list (count 0) are left to the scheduler
+CpuList managerCpus, cookCpus, courierCpus;
+
+// Ready orders moved off readyOrders by the couriers, guarded by mutexCouriers
+RouteBoard readyBoard;
+
+const char *stageNames[STAGE_COUNT] = {"queued", "preparing", "oven wait", "baking", "courier wait", "delivering", "total"};
+Histogram stageLatency[STAGE_COUNT];
+int statsInterval = DEFAULT_STATS_INTERVAL;
+
+// How many orders reached each point of the pipeline, see stats.h
+StatsBlock orderStats;
+
+const char *admissionPolicyNames[] = {"block", "reject", "deadline", "shed"};
+int admissionPolicy = ADMIT_BLOCK;
+int maxQueuedOrders = ORDER_QUEUE_CAPACITY;
+int queueDeadline = DEFAULT_QUEUE_DEADLINE;
+
+// Only the event loop turns orders away, cooks drop expired ones through STAT_DROPPED
+int rejectedOrders = 0;
+int shedOrders = 0;
+atomic_int cancelledOrders;
+// Orders of cancelled clients not collected yet, the drain does not wait for
+// the ones still in queues and deques that the kitchen only drops lazily
+int cancelledPending = 0;
+
+// With -j every order is journaled, orders left unfinished by a crash are cooked again on the next start
+Journal journal;
+char *journalPath = NULL;
+int journalFd = -1;
+uint64_t nextJournalId;
 
 int shopQ = 0;
 int shopP = 0;
 
 int deliverySpeed = 1;
 int serverSocket;
+int epollFd;
+int finishedOrdersFd;
+int clientCount = 0;
+int collectedOrders = 0;
+int pausedClients = 0;
+int outboxDrained = 0; // a paused client got its outbox below OUTBOX_SIZE, it may read again
+int signalFd;
 int cookPoolSize, deliveryPoolSize;
-pthread_t managerThread;
-pthread_t *cookThreads;
-pthread_t *courierThreads;
-int *cookThreadsArgs;
-int *courierThreadsArgs;
 int logFd;
 
-// --- utils ---
-int randomRange(int min, int max)
+typedef struct
 {
-    return rand() % (max - min + 1) + min;
-}
+    pthread_t *threads;
+    int *args;
+    int size;
+} WorkerPool;
+
+pthread_t managerThread;
+WorkerPool cookPool;
+WorkerPool courierPool;
 
-char *getTimestamp()
+// --- utils ---
+long long currentMicros()
 {
-    static char buffer[30];
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    strftime(buffer, 30, "%Y-%m-%d %H:%M:%S", tm_info);
-    return buffer;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
 void cleanup();
+void dumpStats();
+void wakeEveryone();
 void handle_sigint(int sig);
+void closeServerSocket();
+void resumeClients();
 
 void setup_signal_handling()
 {
-    struct sigaction sa;
-    sa.sa_handler = handle_sigint;
-    sa.sa_flags = 0;
-    sigemptyset(&sa.sa_mask);
-    if (sigaction(SIGINT, &sa, NULL) == -1)
+    // SIGINT and SIGUSR1 are blocked in every thread and read from the event loop instead
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0)
     {
-        perror("sigaction");
+        perror("pthread_sigmask");
         exit(EXIT_FAILURE);
     }
-}
-
-void handle_sigint(int sig)
-{
-    printf("Caught signal %d\n", sig);
-    dprintf(logFd, "[%s] Caught signal %d\n", getTimestamp(), sig);
 
-    cleanup();
-    exit(EXIT_SUCCESS);
+    signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd == -1)
+    {
+        perror("signalfd");
+        exit(EXIT_FAILURE);
+    }
 }
 
-void cleanup()
+void handle_sigint(int sig)
 {
-    totalOrders = -1;
-
-    printf("Cleaning up resources...\n");
-    dprintf(logFd, "[%s] Cleaning up resources...\n", getTimestamp());
+    logMessage(LOG_INFO, "Caught signal %d\n", sig);
 
-    if (!connected)
+    if (draining)
     {
-        printf("Cleanup complete.\n");
-        dprintf(logFd, "[%s] Cleanup complete.\n", getTimestamp());
+        logMessage(LOG_INFO, "Stopping without waiting for %d orders\n", statGet(&orderStats, STAT_RECEIVED) - collectedOrders);
 
+        shopOpen = 0;
+        wakeEveryone();
         return;
     }
 
-    // Cancel threads
-    pthread_cancel(managerThread);
-    for (int i = 0; i < cookPoolSize; i++)
+    draining = 1;
+    closeServerSocket();
+
+    logMessage(LOG_INFO, "Shop is closed for new orders, finishing %d orders\n", statGet(&orderStats, STAT_RECEIVED) - collectedOrders - cancelledPending);
+
+    // Orders paused clients still hold get their busy replies now
+    resumeClients();
+}
+
+void startPool(WorkerPool *pool, int size, void *(*routine)(void *), CpuList *cpus)
+{
+    pool->size = size;
+    pool->threads = malloc(size * sizeof(pthread_t));
+    pool->args = malloc(size * sizeof(int));
+    for (int i = 0; i < size; i++)
     {
-        pthread_cancel(cookThreads[i]);
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (cpus->count > 0)
+        {
+            setThreadCpu(&attr, cpus, i);
+        }
+        pool->args[i] = i;
+        pthread_create(&pool->threads[i], &attr, routine, &pool->args[i]);
+        pthread_attr_destroy(&attr);
     }
-    for (int i = 0; i < deliveryPoolSize; i++)
+}
+
+void joinPool(WorkerPool *pool)
+{
+    for (int i = 0; i < pool->size; i++)
     {
-        pthread_cancel(courierThreads[i]);
+        pthread_join(pool->threads[i], NULL);
     }
+}
 
-    // Join threads
-    pthread_join(managerThread, NULL);
-    for (int i = 0; i < cookPoolSize; i++)
+void destroyPool(WorkerPool *pool)
+{
+    free(pool->threads);
+    free(pool->args);
+    pool->threads = NULL;
+    pool->args = NULL;
+    pool->size = 0;
+}
+
+void cleanup()
+{
+    shopOpen = 0;
+    wakeEveryone();
+
+    logMessage(LOG_INFO, "Cleaning up resources...\n");
+
+    if (connected)
     {
-        pthread_join(cookThreads[i], NULL);
+        // Workers leave their loops once the shop is closed
+        pthread_join(managerThread, NULL);
+        joinPool(&cookPool);
+        joinPool(&courierPool);
+
+        logMessage(LOG_INFO, "All threads are done\n");
+
+        // Commits the last records, orders still live are recovered on the next start
+        if (journalPath != NULL)
+        {
+            closeJournal(&journal);
+        }
+
+        logMessage(LOG_INFO, "Stats:\n");
+
+        dumpStats();
+
+        for (int i = 0; i < cookPool.size; i++)
+        {
+            logMessage(LOG_INFO, "Cook %d prepared %d orders\n", i, cookPool.args[i]);
+        }
+
+        for (int i = 0; i < courierPool.size; i++)
+        {
+            logMessage(LOG_INFO, "Courier %d delivered %d orders\n", i, courierPool.args[i]);
+        }
+
+        destroyPool(&cookPool);
+        destroyPool(&courierPool);
+
+        flushPoolCache(&orderPool, &frontEndCache);
+        flushPoolCache(&ovenEntryPool, &frontEndEntryCache);
+        logMessage(LOG_INFO, "Order pool: %ld allocations, %ld mallocs, %ld avoided\n", poolAllocations(&orderPool), poolMallocs(&orderPool), poolAllocations(&orderPool) - poolMallocs(&orderPool));
+        logMessage(LOG_INFO, "Oven entry pool: %ld allocations, %ld mallocs, %ld avoided\n", poolAllocations(&ovenEntryPool), poolMallocs(&ovenEntryPool), poolAllocations(&ovenEntryPool) - poolMallocs(&ovenEntryPool));
+
+        // Orders still in the queues or the oven go away with their pools
+        destroyOvenGroup(&ovens);
+        for (int i = 0; i < cookPoolSize; i++)
+        {
+            destroyWorkDeque(&cookQueues[i].prepWork);
+            destroyWorkDeque(&cookQueues[i].ovenWork);
+        }
+        free(cookQueues);
+        if (numaLocal)
+        {
+            pthread_barrier_destroy(&cookQueuesReady);
+        }
+        destroyRingQueue(&orders);
+        destroyRingQueue(&readyOrders);
+        destroyRingQueue(&preparedOrders);
+        destroyRouteBoard(&readyBoard);
+        destroyRingQueue(&finishedOrders);
+        destroyObjectPool(&orderPool);
+        destroyObjectPool(&ovenEntryPool);
     }
-    for (int i = 0; i < deliveryPoolSize; i++)
+
+    // Close client sockets
+    for (int i = 0; i < MAX_CLIENTS; i++)
     {
-        pthread_join(courierThreads[i], NULL);
+        if (clients[i] != NULL)
+        {
+            if (clients[i]->socket != -1)
+            {
+                close(clients[i]->socket);
+            }
+            free(clients[i]);
+            clients[i] = NULL;
+        }
     }
 
-    // Free allocated memory
-    free(order);
-    free(cookThreads);
-    free(orderWithTime);
-    free(courierThreads);
-    free(cookThreadsArgs);
-    free(courierThreadsArgs);
-
     // Destroy semaphores and mutexes
-    sem_destroy(&semOvenAparatus);
-    sem_destroy(&semOvenDoors);
-    sem_destroy(&semReadyOrders);
-    pthread_mutex_destroy(&mutexOven);
-    pthread_mutex_destroy(&mutexCookedOrders);
-    pthread_mutex_destroy(&mutexDeliveredOrders);
-    pthread_mutex_destroy(&mutexInDeliveryOrders);
-    pthread_mutex_destroy(&mutexOrdersWaitingForOven);
-    pthread_mutex_destroy(&mutexOrdersToBePrepared);
-    pthread_mutex_destroy(&mutexOrdersInPreparation);
-
-    // Clear circular queues
-    clearCircularQueue(&orders);
-    clearCircularQueue(&readyOrders);
-    clearCircularQueue(&ordersInDelivery);
-
-    // Close server socket
-    close(serverSocket);
+    pthread_mutex_destroy(&mutexKitchen);
+    pthread_mutex_destroy(&mutexCouriers);
+    pthread_mutex_destroy(&mutexStatus);
+    pthread_cond_destroy(&condKitchen);
+    pthread_cond_destroy(&condOvenWatch);
+    pthread_cond_destroy(&condCouriers);
+    pthread_cond_destroy(&condStatus);
+
+    // Close server socket and event descriptors
+    closeServerSocket();
+    close(finishedOrdersFd);
+    if (journalFd != -1)
+    {
+        close(journalFd);
+    }
+    close(signalFd);
+    close(epollFd);
 
-    printf("Cleanup complete.\n");
-    dprintf(logFd, "[%s] Cleanup complete.\n", getTimestamp());
+    logMessage(LOG_INFO, "Cleanup complete.\n");
 
+    stopLogger();
     close(logFd);
 }
 
-int pseudoInverse()
+// Returns the measured compute time in microseconds
+long long pseudoInverse(PinvScratch *scratch, Order *order)
+{
+    fillRandomMatrix(scratch, order->customerId * 1000003u + order->p * 1009u + order->q);
+    long long start = currentMicros();
+    computePseudoInverse(scratch);
+    long long end = currentMicros();
+    return end - start;
+}
+
+// --- utils ---
+
+// --- actions ---
+void notifyStatus()
 {
-    // Could not implement calculation of the psuedo-inverse of a 30 by 40 matrix having complex elements
-    time_t start = time(NULL);
-    sleep(randomRange(MIN_ORDER_PREPARATION_TIME, MAX_ORDER_PREPARATION_TIME));
-    time_t end = time(NULL);
-    return (end - start) / 2;
+    pthread_mutex_lock(&mutexStatus);
+    statusVersion++;
+    pthread_cond_signal(&condStatus);
+    pthread_mutex_unlock(&mutexStatus);
 }
 
-int isReadGoingToBlock(client_t *client)
+void notifyCooks(int everyone)
 {
-    struct pollfd pfd;
-    pfd.fd = client->socket;
-    pfd.events = POLLIN;
-    pfd.revents = 0;
-    int ret = poll(&pfd, 1, POLL_TIMEOUT);
-    if (ret == -1)
+    pthread_mutex_lock(&mutexKitchen);
+    if (everyone)
     {
-        perror("poll");
-        return 0;
+        pthread_cond_broadcast(&condKitchen);
+        pthread_cond_broadcast(&condOvenWatch);
     }
-    if (ret == 0)
+    else if (idleCooks > 0)
     {
-        return 1;
+        pthread_cond_signal(&condKitchen);
     }
-    if (pfd.revents & POLLIN)
+    else
     {
-        return 0;
+        // The oven watcher is the only idle cook left
+        pthread_cond_signal(&condOvenWatch);
     }
-    return 1;
+    pthread_mutex_unlock(&mutexKitchen);
 }
-// --- utils ---
 
-// --- actions ---
-void setOrdersToBePrepared(int count)
+void notifyOvenWatcher()
+{
+    pthread_mutex_lock(&mutexKitchen);
+    if (ovenWatched)
+    {
+        pthread_cond_signal(&condOvenWatch);
+    }
+    else if (idleCooks > 0)
+    {
+        pthread_cond_signal(&condKitchen);
+    }
+    pthread_mutex_unlock(&mutexKitchen);
+}
+
+void notifyCouriers()
 {
-    pthread_mutex_lock(&mutexOrdersToBePrepared);
-    ordersToBePrepared = count;
-    pthread_mutex_unlock(&mutexOrdersToBePrepared);
+    pthread_mutex_lock(&mutexCouriers);
+    pthread_cond_broadcast(&condCouriers);
+    pthread_mutex_unlock(&mutexCouriers);
 }
 
-void decreaseOrdersToBePrepared()
+void wakeEveryone()
 {
-    pthread_mutex_lock(&mutexOrdersToBePrepared);
-    ordersToBePrepared--;
-    pthread_mutex_unlock(&mutexOrdersToBePrepared);
+    notifyStatus();
+    notifyCooks(1);
+    notifyCouriers();
 }
 
-void increaseOrdersInPreparation()
+// Counts one order past a point of the pipeline
+void advanceOrders(int stat)
 {
-    pthread_mutex_lock(&mutexOrdersInPreparation);
-    ordersInPreparation++;
-    pthread_mutex_unlock(&mutexOrdersInPreparation);
+    statAdvance(&orderStats, stat);
+    notifyStatus();
 }
 
-void decreaseOrdersInPreparation()
+// Work spread over the cook deques is tracked by the stats block, later points are read first
+int hasPrepWork()
 {
-    pthread_mutex_lock(&mutexOrdersInPreparation);
-    ordersInPreparation--;
-    pthread_mutex_unlock(&mutexOrdersInPreparation);
+    int started = statGet(&orderStats, STAT_PREP_STARTED);
+    return statGet(&orderStats, STAT_RECEIVED) > started;
 }
 
-void increaseCookedOrders()
+// Orders that will still reach the couriers, dropped ones are counted as picked up
+int ordersToPickUp()
 {
-    pthread_mutex_lock(&mutexCookedOrders);
-    ordersToBeDelivered++;
-    cookedOrders++;
-    ordersWaitingForDelivery++;
-    pthread_mutex_unlock(&mutexCookedOrders);
+    int pickedUp = statGet(&orderStats, STAT_PICKED_UP);
+    return statGet(&orderStats, STAT_RECEIVED) - pickedUp;
 }
 
-void decreaseCookedOrders()
+int hasPreparedOrders()
 {
-    pthread_mutex_lock(&mutexCookedOrders);
-    ordersToBeDelivered--;
-    pthread_mutex_unlock(&mutexCookedOrders);
+    int loaded = statGet(&orderStats, STAT_OVEN_IN);
+    return statGet(&orderStats, STAT_PREPARED) > loaded;
 }
 
-void decreaseOrdersWaitingForDelivery()
+// Own deque first, then a batch off the shared queue, then the other cooks
+Order *takePrepWork(int id)
 {
-    pthread_mutex_lock(&mutexCookedOrders);
-    ordersWaitingForDelivery--;
-    pthread_mutex_unlock(&mutexCookedOrders);
+    CookQueues *mine = &cookQueues[id];
+    Order *order = dequePop(&mine->prepWork);
+    if (order != NULL)
+    {
+        return order;
+    }
+
+    // A fair share of the waiting orders, pushed newest first so the owner pops them oldest first
+    Order *batch[COOK_BATCH];
+    int share = (int)(ringSize(&orders) / cookPoolSize);
+    int wanted = share < 1 ? 1 : share > COOK_BATCH ? COOK_BATCH : share;
+    int taken = 0;
+    while (taken < wanted && (batch[taken] = ringDequeue(&orders)) != NULL)
+    {
+        taken++;
+    }
+    if (taken > 0)
+    {
+        for (int i = taken - 1; i > 0; i--)
+        {
+            if (!dequePush(&mine->prepWork, batch[i]))
+            {
+                ringEnqueue(&orders, batch[i]);
+            }
+        }
+        if (taken > 1)
+        {
+            notifyCooks(0);
+        }
+        return batch[0];
+    }
+
+    for (int i = 1; i < cookPoolSize; i++)
+    {
+        WorkDeque *victim = &cookQueues[(id + i) % cookPoolSize].prepWork;
+        order = dequeSteal(victim);
+        if (order != NULL)
+        {
+            // Pass the word on while the victim still has orders to spare
+            if (!dequeIsEmpty(victim))
+            {
+                notifyCooks(0);
+            }
+            return order;
+        }
+    }
+    return NULL;
 }
 
-void increaseDeliveredOrders()
+// Oldest prepared order of this cook, or of any other cook, then one that did not fit a deque
+OrderWithTime *takeOvenWork(int id)
 {
-    pthread_mutex_lock(&mutexDeliveredOrders);
-    deliveredOrders++;
-    pthread_mutex_unlock(&mutexDeliveredOrders);
+    for (int i = 0; i < cookPoolSize; i++)
+    {
+        OrderWithTime *orderWithTime = dequeSteal(&cookQueues[(id + i) % cookPoolSize].ovenWork);
+        if (orderWithTime != NULL)
+        {
+            return orderWithTime;
+        }
+    }
+    return ringDequeue(&preparedOrders);
 }
 
-void increaseOrdersInDelivery()
+// The slot is reserved first, the order is counted in before another cook can take it out
+void putInOven(KitchenOven *kitchenOven, OrderWithTime *orderWithTime)
 {
-    pthread_mutex_lock(&mutexInDeliveryOrders);
-    ordersInDeliveryCount++;
-    pthread_mutex_unlock(&mutexInDeliveryOrders);
+    long long now = currentMicros();
+    orderWithTime->order->stamps[STAMP_OVEN_IN] = now;
+    advanceOrders(STAT_OVEN_IN);
+    ovenPut(&kitchenOven->oven, orderWithTime, now + orderWithTime->time);
+    notifyOvenWatcher();
 }
 
-void decreaseOrdersInDelivery()
+OrderWithTime *takeFromOven(KitchenOven *kitchenOven)
 {
-    pthread_mutex_lock(&mutexInDeliveryOrders);
-    ordersInDeliveryCount--;
-    pthread_mutex_unlock(&mutexInDeliveryOrders);
+    long long now = currentMicros();
+    OrderWithTime *orderWithTime = ovenTakeReady(&kitchenOven->oven, now);
+    if (orderWithTime == NULL)
+    {
+        return NULL;
+    }
+    orderWithTime->order->stamps[STAMP_OVEN_OUT] = now;
+    ovenRecordStay(kitchenOven, now - orderWithTime->order->stamps[STAMP_OVEN_IN]);
+    notifyStatus();
+    if (hasPreparedOrders())
+    {
+        notifyCooks(0);
+    }
+    return orderWithTime;
 }
 
-void increaseOrdersWaitingForOven()
+void recordOrderStages(Order *order)
 {
-    pthread_mutex_lock(&mutexOrdersWaitingForOven);
-    ordersWaitingForOven++;
-    pthread_mutex_unlock(&mutexOrdersWaitingForOven);
+    for (int i = 0; i < STAGE_COUNT - 1; i++)
+    {
+        histogramRecord(&stageLatency[i], order->stamps[i + 1] - order->stamps[i]);
+    }
+    histogramRecord(&stageLatency[STAGE_COUNT - 1], order->stamps[STAMP_DELIVERED] - order->stamps[STAMP_RECEIVED]);
 }
 
-void decreaseOrdersWaitingForOven()
+void finishOrder(Order *order)
 {
-    pthread_mutex_lock(&mutexOrdersWaitingForOven);
-    ordersWaitingForOven--;
-    pthread_mutex_unlock(&mutexOrdersWaitingForOven);
+    uint64_t one = 1;
+    ringEnqueue(&finishedOrders, order);
+    write(finishedOrdersFd, &one, sizeof(one));
 }
 
-void putInOven()
+int isCancelled(Order *order)
 {
-    pthread_mutex_lock(&mutexOven);
-    ovenFree--;
-    pthread_mutex_unlock(&mutexOven);
+    return atomic_load_explicit(&order->token->cancelled, memory_order_acquire);
 }
 
-void takeFromOven()
+// Sends an order that leaves the pipeline early back to the event loop, it is
+// counted past every point from the one it did not reach yet, see STAT_DROPPED
+void dropOrder(Order *order, int from)
 {
-    pthread_mutex_lock(&mutexOven);
-    ovenFree++;
-    pthread_mutex_unlock(&mutexOven);
+    for (int stat = from; stat <= STAT_DELIVERED; stat++)
+    {
+        statAdvance(&orderStats, stat);
+    }
+    order->dropped = 1;
+    if (isCancelled(order))
+    {
+        atomic_fetch_add(&cancelledOrders, 1);
+    }
+    advanceOrders(STAT_DROPPED);
+    notifyCouriers();
+    finishOrder(order);
 }
 // --- actions ---
 
 // --- actors ---
-void *manager(void *arg)
+// Queue depths and per-stage latencies show whether cooks, the oven or couriers hold orders up
+void dumpStats()
 {
-    client_t *client = (client_t *)arg;
-    int buffer[3 * MAX_CLIENTS];
-    int bytesRead = read(client->socket, buffer, sizeof(buffer));
-
-    if (bytesRead == 0)
+    StatsSnapshot snapshot;
+    takeStatsSnapshot(&orderStats, &snapshot);
+    logMessage(LOG_INFO, "Queues: %d to prepare, %d preparing, %d waiting for oven, %d in oven, %d waiting for courier, %d on couriers, %d delivered\n",
+               snapshotWaiting(&snapshot, STAT_RECEIVED), snapshotWaiting(&snapshot, STAT_PREP_STARTED), snapshotWaiting(&snapshot, STAT_PREPARED),
+               snapshotWaiting(&snapshot, STAT_OVEN_IN), snapshotWaiting(&snapshot, STAT_COOKED), snapshotWaiting(&snapshot, STAT_PICKED_UP),
+               snapshotWaiting(&snapshot, STAT_DELIVERED));
+    int cancelled = atomic_load(&cancelledOrders);
+    logMessage(LOG_INFO, "Admission (%s, %d queued at most): %d rejected, %d shed, %d past deadline, %d cancelled in the kitchen\n", admissionPolicyNames[admissionPolicy],
+               maxQueuedOrders, rejectedOrders, shedOrders, snapshotWaiting(&snapshot, STAT_DROPPED) - shedOrders - cancelled, cancelled);
+    if (journalPath != NULL)
     {
-        printf("Client disconnected\n");
-        dprintf(logFd, "[%s] Client disconnected\n", getTimestamp());
-
-        totalOrders = 0;
-        return NULL;
+        long long commits = atomic_load(&journal.commits);
+        long long durable = journalDurable(&journal);
+        logMessage(LOG_INFO, "Journal: %lld records in %lld commits, %.1f records per commit, %lld compactions\n", durable, commits,
+                   commits > 0 ? (double)durable / commits : 0.0, atomic_load(&journal.compactions));
     }
 
-    if (bytesRead == -1)
+    for (int i = 0; i < ovens.count; i++)
     {
-        perror("Could not read from socket");
-        totalOrders = 0;
-        return NULL;
+        KitchenOven *kitchenOven = &ovens.ovens[i];
+        long visits = atomic_load(&kitchenOven->toolVisits);
+        logMessage(LOG_INFO, "Oven %d (%d slots, %d doors, %d paddles): %ld baked, %.1f%% utilized, mean door and paddle wait %.0f us\n", i,
+                   kitchenOven->spec.capacity, kitchenOven->spec.doors, kitchenOven->spec.paddles, atomic_load(&kitchenOven->baked),
+                   100 * ovenUtilization(&ovens, kitchenOven), visits > 0 ? (double)atomic_load(&kitchenOven->toolWaitMicros) / visits : 0.0);
     }
 
-    int ordersCount = bytesRead / sizeof(int) / 3;
-    totalOrders = ordersCount;
-    setOrdersToBePrepared(ordersCount);
-    for (int i = 0; i < bytesRead / sizeof(int); i += 3)
+    for (int i = 0; i < STAGE_COUNT; i++)
     {
-        order = malloc(sizeof(Order));
-        order->customerId = buffer[i + 0];
-        order->p = buffer[i + 1];
-        order->q = buffer[i + 2];
-        enqueue(&orders, order);
-        printf("Put order from client %d from (%d, %d) in queue\n", order->customerId, order->p, order->q);
-        dprintf(logFd, "[%s] Put order from client %d from (%d, %d) in queue\n", getTimestamp(), order->customerId, order->p, order->q);
+        logMessage(LOG_INFO, "Stage %-12s %8ld orders, mean %9.0f us, p50 %9lld us, p99 %9lld us\n", stageNames[i], histogramCount(&stageLatency[i]),
+                   histogramMean(&stageLatency[i]), histogramPercentile(&stageLatency[i], 50), histogramPercentile(&stageLatency[i], 99));
     }
+}
 
-    int previousOrdersWaitingForOven = 0;
-    int previousOrdersInOven = 0;
-    int previousOrdersToDeliver = 0;
-    int previousOrdersInDelivery = 0;
-    int previousDeliveredOrders = 0;
-    int previousOrdersWaitingForDelivery = 0;
-    int previousOrdersToBePrepared = 0;
-    int previousOrdersInPreparation = 0;
+void *manager(void *arg)
+{
+    StatsSnapshot previous = {0};
+    int seenStatusVersion = 0;
+    int dumpedStatusVersion = 0;
+    long long nextDump = currentMicros() + statsInterval * 1000000LL;
 
-    while (totalOrders > deliveredOrders)
+    while (shopOpen)
     {
-        if (
-            previousOrdersInPreparation != ordersInPreparation ||
-            previousOrdersToBePrepared != ordersToBePrepared ||
-            previousOrdersWaitingForOven != ordersWaitingForOven ||
-            previousOrdersInOven != OVEN_CAPACITY - ovenFree ||
-            previousOrdersToDeliver != ordersToBeDelivered ||
-            previousOrdersInDelivery != ordersInDeliveryCount ||
-            previousOrdersWaitingForDelivery != ordersWaitingForDelivery ||
-            previousDeliveredOrders != deliveredOrders)
+        StatsSnapshot snapshot;
+        takeStatsSnapshot(&orderStats, &snapshot);
+        if (memcmp(&snapshot, &previous, sizeof(snapshot)) != 0)
         {
-            printf("Number of orders waiting to be prepared: %d\n", ordersToBePrepared);
-            dprintf(logFd, "[%s] Number of orders waiting to be prepared: %d\n", getTimestamp(), ordersToBePrepared);
-
-            printf("Number of orders in preparation: %d\n", ordersInPreparation);
-            dprintf(logFd, "[%s] Number of orders in preparation: %d\n", getTimestamp(), ordersInPreparation);
+            logMessage(LOG_DEBUG, "Number of orders waiting to be prepared: %d\n", snapshotWaiting(&snapshot, STAT_RECEIVED));
 
-            printf("Number of orders waiting for oven: %d\n", ordersWaitingForOven);
-            dprintf(logFd, "[%s] Number of orders waiting for oven: %d\n", getTimestamp(), ordersWaitingForOven);
+            logMessage(LOG_DEBUG, "Number of orders in preparation: %d\n", snapshotWaiting(&snapshot, STAT_PREP_STARTED));
 
-            printf("Number of orders in oven: %d\n", OVEN_CAPACITY - ovenFree);
-            dprintf(logFd, "[%s] Number of orders in oven: %d\n", getTimestamp(), OVEN_CAPACITY - ovenFree);
+            logMessage(LOG_DEBUG, "Number of orders waiting for oven: %d\n", snapshotWaiting(&snapshot, STAT_PREPARED));
 
-            printf("Number of orders waiting couriers: %d\n", ordersWaitingForDelivery);
-            dprintf(logFd, "[%s] Number of orders waiting couriers: %d\n", getTimestamp(), ordersWaitingForDelivery);
+            logMessage(LOG_DEBUG, "Number of orders in oven: %d\n", snapshotWaiting(&snapshot, STAT_OVEN_IN));
 
-            printf("Number of orders on couriers: %d\n", ordersInDeliveryCount);
-            dprintf(logFd, "[%s] Number of orders on couriers: %d\n", getTimestamp(), ordersInDeliveryCount);
+            logMessage(LOG_DEBUG, "Number of orders waiting couriers: %d\n", snapshotWaiting(&snapshot, STAT_COOKED));
 
-            printf("Number of delivered orders: %d\n", deliveredOrders);
-            dprintf(logFd, "[%s] Number of delivered orders: %d\n", getTimestamp(), deliveredOrders);
+            logMessage(LOG_DEBUG, "Number of orders on couriers: %d\n", snapshotWaiting(&snapshot, STAT_PICKED_UP));
 
-            previousOrdersWaitingForOven = ordersWaitingForOven;
-            previousOrdersInOven = OVEN_CAPACITY - ovenFree;
-            previousOrdersToDeliver = ordersToBeDelivered;
-            previousOrdersInDelivery = ordersInDeliveryCount;
-            previousDeliveredOrders = deliveredOrders;
-            previousOrdersWaitingForDelivery = ordersWaitingForDelivery;
-            previousOrdersToBePrepared = ordersToBePrepared;
-            previousOrdersInPreparation = ordersInPreparation;
+            logMessage(LOG_DEBUG, "Number of delivered orders: %d\n", snapshotWaiting(&snapshot, STAT_DELIVERED));
 
-            while (ordersToBeDelivered > 0)
-            {
-                decreaseCookedOrders();
-                sem_post(&semReadyOrders);
-            }
+            previous = snapshot;
         }
 
-        if (!isReadGoingToBlock(client))
+        // Stats are dumped every statsInterval seconds, unless nothing happened since the last dump
+        if (statsInterval > 0 && currentMicros() >= nextDump)
         {
-            char buffer[BUFFER_SIZE];
-            int bytesRead = read(client->socket, buffer, sizeof(buffer));
-            if (bytesRead == 0)
+            if (dumpedStatusVersion != seenStatusVersion)
             {
-                printf("Client disconnected\n");
-                dprintf(logFd, "[%s] Client disconnected\n", getTimestamp());
-
-                totalOrders = 0;
-                return NULL;
+                dumpStats();
+                dumpedStatusVersion = seenStatusVersion;
             }
+            nextDump = currentMicros() + statsInterval * 1000000LL;
+        }
 
-            if (bytesRead == -1)
+        pthread_mutex_lock(&mutexStatus);
+        while (shopOpen && seenStatusVersion == statusVersion)
+        {
+            if (statsInterval == 0)
             {
-                perror("Could not read from socket");
-                totalOrders = 0;
-                return NULL;
+                pthread_cond_wait(&condStatus, &mutexStatus);
+                continue;
             }
-
-            if (strncmp(buffer, "CANCEL", 6) == 0)
+            struct timespec deadline;
+            deadline.tv_sec = nextDump / 1000000;
+            deadline.tv_nsec = (nextDump % 1000000) * 1000;
+            if (pthread_cond_timedwait(&condStatus, &mutexStatus, &deadline) == ETIMEDOUT)
             {
-                printf("Client cancelled orders\n");
-                dprintf(logFd, "[%s] Client cancelled orders\n", getTimestamp());
-
-                totalOrders = 0;
-                return NULL;
+                break;
             }
         }
-
-        sleep(1);
+        seenStatusVersion = statusVersion;
+        pthread_mutex_unlock(&mutexStatus);
     }
 
-    printf("All orders are cooked and delivered\n");
-    dprintf(logFd, "[%s] All orders are cooked and delivered\n", getTimestamp());
-
     return NULL;
 }
 
-void *cook(void *arg)
+int hasOvenWork()
 {
-    int id = *(int *)arg;
-
-    CircularQueue ordersToPutInOven, ordersToTakeOutFromOven;
-    initCircularQueue(&ordersToPutInOven);
-    initCircularQueue(&ordersToTakeOutFromOven);
-
-    int ordersCount = 0;
+    long long deadline = ovenGroupNextDeadline(&ovens);
+    return (deadline != -1 && deadline <= currentMicros()) || (hasPreparedOrders() && ovenGroupFreeSlots(&ovens) > 0);
+}
 
-    while (cookedOrders < totalOrders)
+void waitForCookWork()
+{
+    pthread_mutex_lock(&mutexKitchen);
+    while (shopOpen && !hasPrepWork() && !hasOvenWork())
     {
-        Order *order = dequeue(&orders);
-
-        if (order != NULL)
+        long long deadline = ovenGroupNextDeadline(&ovens);
+        if (ovenWatched || deadline == -1)
         {
-            decreaseOrdersToBePrepared();
-            increaseOrdersInPreparation();
+            idleCooks++;
+            pthread_cond_wait(&condKitchen, &mutexKitchen);
+            idleCooks--;
+            continue;
+        }
 
-            printf("Cook %d is preparing order for customer %d\n", id, order->customerId);
-            dprintf(logFd, "[%s] Cook %d is preparing order for customer %d\n", getTimestamp(), id, order->customerId);
+        struct timespec wakeTime = {deadline / 1000000, (deadline % 1000000) * 1000};
+        ovenWatched = 1;
+        pthread_cond_timedwait(&condOvenWatch, &mutexKitchen, &wakeTime);
+        ovenWatched = 0;
+    }
 
-            int sleepTime = pseudoInverse();
+    // Leaving for other work, so another idle cook takes over watching the oven
+    if (!ovenWatched && idleCooks > 0 && ovenGroupNextDeadline(&ovens) != -1)
+    {
+        pthread_cond_signal(&condKitchen);
+    }
+    pthread_mutex_unlock(&mutexKitchen);
+}
 
-            decreaseOrdersInPreparation();
+// Waits until a batch can leave and takes it off the board. A partial batch
+// leaves when there are not enough undispatched orders left to fill it.
+int waitForRouteBatch(RouteStop *batch)
+{
+    int stops = 0;
+    pthread_mutex_lock(&mutexCouriers);
+    while (shopOpen)
+    {
+        Order *order;
+        while ((order = ringDequeue(&readyOrders)) != NULL)
+        {
+            routeBoardAdd(&readyBoard, order->p, order->q, order);
+        }
 
-            printf("Cook %d prepared order for customer %d\n", id, order->customerId);
-            dprintf(logFd, "[%s] Cook %d prepared order for customer %d\n", getTimestamp(), id, order->customerId);
+        int waiting = routeBoardCount(&readyBoard);
+        if (waiting >= DELIVERY_ORDER_COUNT ||
+            (waiting > 0 && ordersToPickUp() < DELIVERY_ORDER_COUNT))
+        {
+            stops = takeRouteBatch(&readyBoard, batch, DELIVERY_ORDER_COUNT);
+            break;
+        }
 
-            orderWithTime = malloc(sizeof(OrderWithTime));
-            orderWithTime->order = order;
-            orderWithTime->time = sleepTime;
-            enqueue(&ordersToPutInOven, orderWithTime);
+        pthread_cond_wait(&condCouriers, &mutexCouriers);
+    }
+    pthread_mutex_unlock(&mutexCouriers);
+    return stops;
+}
 
-            increaseOrdersWaitingForOven();
-        }
+void *cook(void *arg)
+{
+    int id = *(int *)arg;
 
-        int ovenAvailable = sem_trywait(&semOvenDoors);
+    int ordersCount = 0;
+    PoolCache ovenEntryCache;
+    initPoolCache(&ovenEntryCache);
 
-        if (ovenAvailable == -1 && errno == EAGAIN)
+    if (numaLocal)
+    {
+        if (initWorkDeque(&cookQueues[id].prepWork, COOK_DEQUE_CAPACITY) == -1 ||
+            initWorkDeque(&cookQueues[id].ovenWork, COOK_DEQUE_CAPACITY) == -1)
         {
-            continue;
+            perror("Could not allocate cook queues");
+            exit(EXIT_FAILURE);
         }
+        // Nobody steals before every deque exists
+        pthread_barrier_wait(&cookQueuesReady);
+    }
+
+    PinvScratch *scratch = createPinvScratch();
+    if (scratch == NULL)
+    {
+        perror("Could not allocate pseudo-inverse scratch");
+        return NULL;
+    }
 
-        int paddleAvailable = sem_trywait(&semOvenAparatus);
+    while (shopOpen)
+    {
+        Order *order = takePrepWork(id);
 
-        if (paddleAvailable == -1 && errno == EAGAIN)
+        if (order != NULL && isCancelled(order))
         {
-            sem_post(&semOvenDoors);
+            logMessage(LOG_DEBUG, "Cook %d skipped cancelled order for customer %d\n", id, order->customerId);
+
+            dropOrder(order, STAT_PREP_STARTED);
             continue;
         }
 
-        OrderWithTime *firstOrder = peek(&ordersToTakeOutFromOven);
-        next(&ordersToTakeOutFromOven);
-        OrderWithTime *currentOrder = peek(&ordersToTakeOutFromOven);
-        while (currentOrder != firstOrder)
+        if (order != NULL)
         {
-            if (currentOrder->time > time(NULL))
+            advanceOrders(STAT_PREP_STARTED);
+
+            if (admissionPolicy == ADMIT_DEADLINE && currentMicros() - order->stamps[STAMP_RECEIVED] > queueDeadline * 1000LL)
             {
-                next(&ordersToTakeOutFromOven);
-                currentOrder = peek(&ordersToTakeOutFromOven);
+                logMessage(LOG_DEBUG, "Cook %d dropped order for customer %d, it waited past the deadline\n", id, order->customerId);
+
+                dropOrder(order, STAT_PREPARED);
                 continue;
             }
 
-            pthread_mutex_lock(&mutexOven);
-            ovenFree++;
-            pthread_mutex_unlock(&mutexOven);
+            logMessage(LOG_DEBUG, "Cook %d is preparing order for customer %d\n", id, order->customerId);
 
-            currentOrder = dequeue(&ordersToTakeOutFromOven);
-            enqueue(&readyOrders, currentOrder->order);
+            order->stamps[STAMP_PREP_START] = currentMicros();
+            long long computeTime = pseudoInverse(scratch, order);
+            order->stamps[STAMP_PREP_END] = currentMicros();
 
-            printf("Cook %d put order for customer %d in the delivery queue\n", id, currentOrder->order->customerId);
-            dprintf(logFd, "[%s] Cook %d put order for customer %d in the delivery queue\n", getTimestamp(), id, currentOrder->order->customerId);
+            logMessage(LOG_DEBUG, "Cook %d prepared order for customer %d in %lld us\n", id, order->customerId, computeTime);
 
-            ordersCount++;
+            // Counted before the hand-off, so the next stage can never count it first
+            advanceOrders(STAT_PREPARED);
 
-            increaseCookedOrders();
+            // Every prepared order is counted, so it has to reach an oven or be dropped
+            OrderWithTime *orderWithTime = poolAlloc(&ovenEntryPool, &ovenEntryCache);
+            if (orderWithTime == NULL)
+            {
+                perror("poolAlloc");
+                dropOrder(order, STAT_OVEN_IN);
+            }
+            else
+            {
+                orderWithTime->order = order;
+                orderWithTime->time = computeTime / 2;
+                if (!dequePush(&cookQueues[id].ovenWork, orderWithTime) && !ringEnqueue(&preparedOrders, orderWithTime))
+                {
+                    perror("Could not queue the order for the oven");
+                    poolFree(&ovenEntryPool, &ovenEntryCache, orderWithTime);
+                    dropOrder(order, STAT_OVEN_IN);
+                }
+            }
 
-            free(currentOrder);
-            next(&ordersToTakeOutFromOven);
+            ordersCount++;
         }
 
-        if (currentOrder != NULL && currentOrder->time <= time(NULL))
+        // Doors and paddles are only taken when there is something to put in or take out
+        if (!hasOvenWork())
         {
-            pthread_mutex_lock(&mutexOven);
-            ovenFree++;
-            pthread_mutex_unlock(&mutexOven);
-
-            currentOrder = dequeue(&ordersToTakeOutFromOven);
-            enqueue(&readyOrders, currentOrder->order);
-
-            printf("Cook %d put order for customer %d in the delivery queue\n", id, currentOrder->order->customerId);
-            dprintf(logFd, "[%s] Cook %d put order for customer %d in the delivery queue\n", getTimestamp(), id, currentOrder->order->customerId);
-
-            ordersCount++;
+            if (order == NULL)
+            {
+                waitForCookWork();
+            }
+            continue;
+        }
 
-            increaseCookedOrders();
+        // Done pides come out of every oven, this cook starts at its own so cooks
+        // spread out. The cook keeps the door and paddle of the oven it is at
+        // while the allocator keeps picking that oven for the prepared pides.
+        OrderWithTime *orderWithTime;
+        KitchenOven *entered = NULL;
+        long long now = currentMicros();
+        for (int i = 0; i < ovens.count; i++)
+        {
+            KitchenOven *kitchenOven = &ovens.ovens[(id + i) % ovens.count];
+            long long deadline = ovenNextDeadline(&kitchenOven->oven);
+            if (deadline == -1 || deadline > now)
+            {
+                continue;
+            }
 
-            free(currentOrder);
+            if (entered != NULL)
+            {
+                leaveOven(entered);
+            }
+            enterOven(kitchenOven);
+            entered = kitchenOven;
+            while ((orderWithTime = takeFromOven(kitchenOven)) != NULL)
+            {
+                logMessage(LOG_DEBUG, "Cook %d put order for customer %d in the delivery queue\n", id, orderWithTime->order->customerId);
+
+                if (journalPath != NULL)
+                {
+                    Order *cooked = orderWithTime->order;
+                    journalAppend(&journal, JOURNAL_COOKED, cooked->journalId, cooked->customerId, cooked->p, cooked->q);
+                }
+                advanceOrders(STAT_COOKED);
+                ringEnqueue(&readyOrders, orderWithTime->order);
+                notifyCouriers();
+
+                poolFree(&ovenEntryPool, &ovenEntryCache, orderWithTime);
+            }
         }
 
-        while (ovenFree > 0)
+        // The allocator picks the oven for every pide
+        int slot;
+        while ((slot = ovenGroupReserve(&ovens)) != -1)
         {
-            OrderWithTime *orderWithTime = dequeue(&ordersToPutInOven);
+            KitchenOven *kitchenOven = &ovens.ovens[slot];
+            while ((orderWithTime = takeOvenWork(id)) != NULL && isCancelled(orderWithTime->order))
+            {
+                logMessage(LOG_DEBUG, "Cook %d skipped cancelled order for customer %d\n", id, orderWithTime->order->customerId);
 
+                dropOrder(orderWithTime->order, STAT_OVEN_IN);
+                poolFree(&ovenEntryPool, &ovenEntryCache, orderWithTime);
+            }
             if (orderWithTime == NULL)
             {
+                ovenReleaseSlot(&kitchenOven->oven);
                 break;
             }
 
-            pthread_mutex_lock(&mutexOven);
-            if (ovenFree == 0)
+            logMessage(LOG_DEBUG, "Cook %d is putting order for customer %d in oven %d\n", id, orderWithTime->order->customerId, slot);
+
+            if (entered != kitchenOven)
             {
-                pthread_mutex_unlock(&mutexOven);
-                enqueue(&ordersToPutInOven, orderWithTime);
-                break;
+                if (entered != NULL)
+                {
+                    leaveOven(entered);
+                }
+                enterOven(kitchenOven);
+                entered = kitchenOven;
             }
-            ovenFree--;
-            pthread_mutex_unlock(&mutexOven);
-
-            decreaseOrdersWaitingForOven();
-
-            orderWithTime->time += time(NULL);
-            enqueue(&ordersToTakeOutFromOven, orderWithTime);
-
-            printf("Cook %d put order for customer %d in the oven\n", id, orderWithTime->order->customerId);
-            dprintf(logFd, "[%s] Cook %d put order for customer %d in the oven\n", getTimestamp(), id, orderWithTime->order->customerId);
+            putInOven(kitchenOven, orderWithTime);
+        }
+        if (entered != NULL)
+        {
+            leaveOven(entered);
         }
-
-        sem_post(&semOvenAparatus);
-        sem_post(&semOvenDoors);
     }
 
-    printf("Cook %d is done\n", id);
-    dprintf(logFd, "[%s] Cook %d is done\n", getTimestamp(), id);
+    flushPoolCache(&ovenEntryPool, &ovenEntryCache);
+    destroyPinvScratch(scratch);
+
+    logMessage(LOG_DEBUG, "Cook %d is done\n", id);
 
     *(int *)arg = ordersCount;
 
@@ -608,99 +1005,1009 @@ void *courier(void *arg)
 {
     int id = *(int *)arg;
 
-    CircularQueue myOrders;
-    initCircularQueue(&myOrders);
-    int myQ = 0;
-    int myP = 0;
+    RouteStop route[DELIVERY_ORDER_COUNT];
     int ordersCount = 0;
-    while (deliveredOrders < totalOrders)
+    while (shopOpen)
     {
+        int batch = waitForRouteBatch(route);
 
-        if (myOrders.size == DELIVERY_ORDER_COUNT || (totalOrders - deliveredOrders - ordersInDeliveryCount) < DELIVERY_ORDER_COUNT)
+        // Cancelled orders are dropped here, outside mutexCouriers
+        int stops = 0;
+        for (int i = 0; i < batch; i++)
         {
-            while (myOrders.size > 0)
+            Order *order = route[i].data;
+            if (isCancelled(order))
             {
-                Order *order = dequeue(&myOrders);
-
-                printf("Courier %d is delivering order for customer %d to position (%d, %d)\n", id, order->customerId, order->p, order->q);
-                dprintf(logFd, "[%s] Courier %d is delivering order for customer %d to position (%d, %d)\n", getTimestamp(), id, order->customerId, order->p, order->q);
-                sleep((((order->p - myP) * (order->p - myP) + (order->q - myQ) * (order->q - myQ))) / (deliverySpeed * 10000));
-                printf("Order for customer %d to position (%d, %d) is delivered\n", order->customerId, order->p, order->q);
-                dprintf(logFd, "[%s] Order for customer %d to position (%d, %d) is delivered\n", getTimestamp(), order->customerId, order->p, order->q);
-
-                myP = order->p;
-                myQ = order->q;
-                free(order);
-                ordersCount++;
-                decreaseOrdersInDelivery();
-                increaseDeliveredOrders();
+                dropOrder(order, STAT_PICKED_UP);
             }
-            if (myP + myQ)
+            else
             {
-                printf("Courier %d is returning to the shop\n", id);
-                dprintf(logFd, "[%s] Courier %d is returning to the shop\n", getTimestamp(), id);
-
-                sleep((myP * myP + myQ * myQ) / (deliverySpeed * 10000));
-                printf("Courier %d returned to the shop\n", id);
-                dprintf(logFd, "[%s] Courier %d returned to the shop\n", getTimestamp(), id);
-
-                myP = 0;
-                myQ = 0;
+                route[stops++] = route[i];
             }
         }
-
-        int readyOrdersAvailable = sem_trywait(&semReadyOrders);
-
-        if (readyOrdersAvailable == -1 && errno == EAGAIN)
+        if (stops == 0)
         {
             continue;
         }
 
-        Order *order = dequeue(&readyOrders);
-        if (order != NULL)
+        long long pickup = currentMicros();
+        for (int i = 0; i < stops; i++)
         {
-            decreaseOrdersWaitingForDelivery();
-            enqueue(&myOrders, order);
-            increaseOrdersInDelivery();
-            printf("Courier %d is taking order for customer %d\n", id, order->customerId);
-            dprintf(logFd, "[%s] Courier %d is taking order for customer %d\n", getTimestamp(), id, order->customerId);
+            Order *order = route[i].data;
+            order->stamps[STAMP_PICKUP] = pickup;
+            advanceOrders(STAT_PICKED_UP);
+            logMessage(LOG_DEBUG, "Courier %d is taking order for customer %d\n", id, order->customerId);
         }
-    }
+        notifyCouriers();
 
-    printf("Courier %d is done\n", id);
-    dprintf(logFd, "[%s] Courier %d is done\n", getTimestamp(), id);
+        long long cost = planRoute(route, stops, 0, 0);
+        logMessage(LOG_DEBUG, "Courier %d planned a route through %d stops with cost %lld\n", id, stops, cost);
 
-    if (myP + myQ)
-    {
-        printf("Courier %d is returning to the shop\n", id);
-        dprintf(logFd, "[%s] Courier %d is returning to the shop\n", getTimestamp(), id);
+        int myP = 0;
+        int myQ = 0;
+        for (int i = 0; i < stops; i++)
+        {
+            Order *order = route[i].data;
+            if (isCancelled(order))
+            {
+                logMessage(LOG_DEBUG, "Courier %d skipped cancelled order for customer %d\n", id, order->customerId);
+
+                dropOrder(order, STAT_DELIVERED);
+                continue;
+            }
+
+            logMessage(LOG_DEBUG, "Courier %d is delivering order for customer %d to position (%d, %d)\n", id, order->customerId, order->p, order->q);
+            sleep(legCost(myP, myQ, order->p, order->q) / (deliverySpeed * 10000));
+            logMessage(LOG_DEBUG, "Order for customer %d to position (%d, %d) is delivered\n", order->customerId, order->p, order->q);
 
-        sleep((myP * myP + myQ * myQ) / (deliverySpeed * 10000));
-        printf("Courier %d returned to the shop\n", id);
-        dprintf(logFd, "[%s] Courier %d returned to the shop\n", getTimestamp(), id);
+            myP = order->p;
+            myQ = order->q;
+            ordersCount++;
+            order->stamps[STAMP_DELIVERED] = currentMicros();
+            recordOrderStages(order);
+            advanceOrders(STAT_DELIVERED);
+            finishOrder(order);
+        }
+
+        if (myP + myQ)
+        {
+            logMessage(LOG_DEBUG, "Courier %d is returning to the shop\n", id);
 
-        myP = 0;
-        myQ = 0;
+            sleep(legCost(myP, myQ, 0, 0) / (deliverySpeed * 10000));
+            logMessage(LOG_DEBUG, "Courier %d returned to the shop\n", id);
+        }
     }
 
+    logMessage(LOG_DEBUG, "Courier %d is done\n", id);
+
     *(int *)arg = ordersCount;
 
     return NULL;
 }
 // --- actors ---
 
-int main(int argc, char *argv[])
+// --- front end ---
+void releaseClient(client_t *client)
 {
-    if (argc != 5)
+    if (client->paused)
     {
-        fprintf(stderr, "Usage: %s [port] [cookPoolSize] [deliveryPoolSize] [deliverySpeed]\n", argv[0]);
-        return 1;
+        client->paused = 0;
+        pausedClients--;
     }
 
-    int port = atoi(argv[1]);
-    cookPoolSize = atoi(argv[2]);
-    deliveryPoolSize = atoi(argv[3]);
-    deliverySpeed = atoi(argv[4]);
+    if (client->socket != -1)
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, client->socket, NULL);
+        close(client->socket);
+        client->socket = -1;
+    }
+
+    // Orders still in the kitchen point at the client, it is freed with the last of them
+    if (client->finishedOrders == client->receivedOrders)
+    {
+        clients[client->slot] = NULL;
+        free(client->outbox);
+        free(client);
+        clientCount--;
+    }
+}
+
+void closeServerSocket()
+{
+    if (serverSocket == -1)
+    {
+        return;
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, serverSocket, NULL);
+    close(serverSocket);
+    serverSocket = -1;
+}
+
+// Orders admitted but not taken by a cook yet
+int queuedOrders()
+{
+    int started = statGet(&orderStats, STAT_PREP_STARTED);
+    return statGet(&orderStats, STAT_RECEIVED) - started;
+}
+
+// Time the cooks need to start every queued order, from the mean preparation time so far
+int retryAfterMillis()
+{
+    Histogram *preparing = &stageLatency[STAMP_PREP_START];
+    double prepare = histogramCount(preparing) > 0 ? histogramMean(preparing) : DEFAULT_PREPARE_MICROS;
+    double wait = queuedOrders() * prepare / cookPoolSize / 1000;
+    return wait < 1 ? 1 : wait > INT_MAX ? INT_MAX : (int)wait;
+}
+
+void encodeBusy(char *record, int customerId)
+{
+    encodeInt(record, customerId);
+    encodeInt(record + 4, retryAfterMillis());
+}
+
+// Tells a client past MAX_CLIENTS when to come back, best effort since it is closed right away
+void refuseClient(int clientSocket)
+{
+    char frame[FRAME_HEADER_SIZE + BUSY_RECORD_SIZE];
+    encodeFrameHeader(frame, FRAME_BUSY, BUSY_RECORD_SIZE);
+    encodeBusy(frame + FRAME_HEADER_SIZE, NO_CUSTOMER);
+    send(clientSocket, frame, sizeof(frame), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(clientSocket);
+}
+
+// Drops the oldest order still on the shared queue, orders already split
+// between the cooks are left to them. Returns 0 if there was none.
+int shedOldestOrder()
+{
+    Order *order = ringDequeue(&orders);
+    if (order == NULL)
+    {
+        return 0;
+    }
+    logMessage(LOG_DEBUG, "Shed order for customer %d to make room\n", order->customerId);
+
+    dropOrder(order, STAT_PREP_STARTED);
+    shedOrders++;
+    return 1;
+}
+
+void acceptClients()
+{
+    while (serverSocket != -1)
+    {
+        struct sockaddr_in address;
+        socklen_t addrLen = sizeof(address);
+        int clientSocket = accept(serverSocket, (struct sockaddr *)&address, &addrLen);
+        if (clientSocket == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("Accept failed");
+            }
+            return;
+        }
+
+        int slot = 0;
+        while (slot < MAX_CLIENTS && clients[slot] != NULL)
+        {
+            slot++;
+        }
+        if (slot == MAX_CLIENTS)
+        {
+            logMessage(LOG_INFO, "Refused %s:%d, too many clients\n", inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+            refuseClient(clientSocket);
+            continue;
+        }
+
+        client_t *client = malloc(sizeof(client_t));
+        char *outbox = malloc(OUTBOX_SIZE);
+        if (client == NULL || outbox == NULL)
+        {
+            perror("malloc");
+            free(client);
+            free(outbox);
+            close(clientSocket);
+            continue;
+        }
+        client->slot = slot;
+        client->socket = clientSocket;
+        client->address = address;
+        client->buffered = 0;
+        client->frameType = 0;
+        client->frameLeft = 0;
+        client->outbox = outbox;
+        client->outboxCapacity = OUTBOX_SIZE;
+        client->outboxed = 0;
+        client->receivedOrders = 0;
+        client->finishedOrders = 0;
+        client->rejectedOrders = 0;
+        client->ackSequence = 0;
+        client->nextAckSequence = 0;
+        client->ended = 0;
+        client->cancelled = 0;
+        atomic_init(&client->token.cancelled, 0);
+        client->paused = 0;
+        client->closing = 0;
+        client->events = EPOLLIN | EPOLLRDHUP;
+
+        fcntl(clientSocket, F_SETFL, fcntl(clientSocket, F_GETFL) | O_NONBLOCK);
+
+        struct epoll_event event;
+        event.events = client->events;
+        event.data.ptr = client;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientSocket, &event) == -1)
+        {
+            perror("epoll_ctl");
+            close(clientSocket);
+            free(client->outbox);
+            free(client);
+            continue;
+        }
+        clients[slot] = client;
+        clientCount++;
+
+        logMessage(LOG_INFO, "Accepted orders from %s:%d\n", inet_ntoa(client->address.sin_addr), ntohs(client->address.sin_port));
+    }
+}
+
+// Frames are never dropped, the client waits for every DELIVERED and BUSY
+// record before it ends. The outbox grows instead, takeOrders stops making
+// new frames for a client that is not reading them.
+void queueFrame(client_t *client, int type, const char *payload, int length)
+{
+    int needed = client->outboxed + FRAME_HEADER_SIZE + length;
+    if (needed > client->outboxCapacity)
+    {
+        int capacity = client->outboxCapacity;
+        while (capacity < needed)
+        {
+            capacity *= 2;
+        }
+        char *outbox = realloc(client->outbox, capacity);
+        if (outbox == NULL)
+        {
+            perror("Could not grow the outbox");
+            exit(EXIT_FAILURE);
+        }
+        client->outbox = outbox;
+        client->outboxCapacity = capacity;
+    }
+    encodeFrameHeader(client->outbox + client->outboxed, type, length);
+    memcpy(client->outbox + client->outboxed + FRAME_HEADER_SIZE, payload, length);
+    client->outboxed += FRAME_HEADER_SIZE + length;
+}
+
+void queueCount(client_t *client, int type, int count)
+{
+    char payload[COUNT_PAYLOAD_SIZE];
+    encodeInt(payload, count);
+    queueFrame(client, type, payload, sizeof(payload));
+}
+
+void updateClientEvents(client_t *client)
+{
+    uint32_t events = (client->paused ? 0 : EPOLLIN | EPOLLRDHUP) | (client->outboxed > 0 ? EPOLLOUT : 0);
+    if (events == client->events)
+    {
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = client;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, client->socket, &event);
+    client->events = events;
+}
+
+void setClientPaused(client_t *client, int paused)
+{
+    if (client->paused == paused)
+    {
+        return;
+    }
+    pausedClients += paused ? 1 : -1;
+    client->paused = paused;
+    updateClientEvents(client);
+}
+
+// Returns -1 if the client was released
+int flushClient(client_t *client)
+{
+    if (client->socket == -1)
+    {
+        return 0;
+    }
+
+    while (client->outboxed > 0)
+    {
+        int written = send(client->socket, client->outbox, client->outboxed, MSG_NOSIGNAL);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            perror("Could not write to socket");
+            releaseClient(client);
+            return -1;
+        }
+        memmove(client->outbox, client->outbox + written, client->outboxed - written);
+        client->outboxed -= written;
+    }
+
+    if (client->paused && client->outboxed < OUTBOX_SIZE)
+    {
+        outboxDrained = 1;
+    }
+
+    if (client->outboxed == 0 && client->closing)
+    {
+        releaseClient(client);
+        return -1;
+    }
+
+    updateClientEvents(client);
+    return 0;
+}
+
+void serveIfDone(client_t *client)
+{
+    if (client->closing || client->cancelled || !client->ended || client->finishedOrders != client->receivedOrders)
+    {
+        return;
+    }
+
+    logMessage(LOG_INFO, "Done serving to %s:%d\n\n", inet_ntoa(client->address.sin_addr), ntohs(client->address.sin_port));
+
+    queueCount(client, FRAME_DONE, client->finishedOrders);
+    client->closing = 1;
+}
+
+int isOvenEntryOf(void *data, void *token)
+{
+    return ((OrderWithTime *)data)->order->token == token;
+}
+
+int isOrderOf(void *data, void *token)
+{
+    return ((Order *)data)->token == token;
+}
+
+// Orders in the queues and cook deques are dropped by the next thread that
+// takes them. The ones in the oven are taken out right away to free their
+// slots, the ones waiting for a courier so couriers on long legs do not hold them.
+void cancelOrders(client_t *client)
+{
+    atomic_store_explicit(&client->token.cancelled, 1, memory_order_release);
+    cancelledPending += client->receivedOrders - client->finishedOrders;
+
+    pthread_mutex_lock(&mutexCouriers);
+    Order *ready;
+    while ((ready = ringDequeue(&readyOrders)) != NULL)
+    {
+        routeBoardAdd(&readyBoard, ready->p, ready->q, ready);
+    }
+    void **waiting = malloc((routeBoardCount(&readyBoard) + 1) * sizeof(void *));
+    int waitingCount = waiting == NULL ? 0 : routeBoardRemoveWhere(&readyBoard, isOrderOf, &client->token, waiting);
+    pthread_mutex_unlock(&mutexCouriers);
+    for (int i = 0; i < waitingCount; i++)
+    {
+        dropOrder(waiting[i], STAT_PICKED_UP);
+    }
+    free(waiting);
+    if (waitingCount > 0)
+    {
+        logMessage(LOG_DEBUG, "Took %d cancelled orders off the courier board\n", waitingCount);
+    }
+
+    int count = 0;
+    void *removed[ovens.maxCapacity];
+    for (int i = 0; i < ovens.count; i++)
+    {
+        KitchenOven *kitchenOven = &ovens.ovens[i];
+        int taken = ovenRemoveWhere(&kitchenOven->oven, isOvenEntryOf, &client->token, removed);
+        long long now = currentMicros();
+        for (int j = 0; j < taken; j++)
+        {
+            OrderWithTime *orderWithTime = removed[j];
+            ovenRecordStay(kitchenOven, now - orderWithTime->order->stamps[STAMP_OVEN_IN]);
+            dropOrder(orderWithTime->order, STAT_COOKED);
+            poolFree(&ovenEntryPool, &frontEndEntryCache, orderWithTime);
+        }
+        count += taken;
+    }
+    if (count > 0)
+    {
+        logMessage(LOG_DEBUG, "Took %d cancelled orders out of the oven\n", count);
+
+        notifyCooks(0);
+        notifyOvenWatcher();
+    }
+}
+
+// With a journal an order is only acknowledged once its record is durable. A
+// client keeps the ACK waiting for the oldest commit and the latest one after it.
+void deferAck(client_t *client, long long sequence)
+{
+    if (client->ackSequence == 0)
+    {
+        client->ackSequence = sequence;
+        client->ackCount = client->receivedOrders;
+    }
+    else
+    {
+        client->nextAckSequence = sequence;
+        client->nextAckCount = client->receivedOrders;
+    }
+}
+
+void ackDurableOrders()
+{
+    uint64_t count;
+    read(journalFd, &count, sizeof(count));
+
+    long long durable = journalDurable(&journal);
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        client_t *client = clients[i];
+        if (client == NULL || client->socket == -1 || client->ackSequence == 0 || client->ackSequence > durable)
+        {
+            continue;
+        }
+
+        int acked = client->ackCount;
+        client->ackSequence = 0;
+        if (client->nextAckSequence != 0 && client->nextAckSequence <= durable)
+        {
+            acked = client->nextAckCount;
+        }
+        else if (client->nextAckSequence != 0)
+        {
+            client->ackSequence = client->nextAckSequence;
+            client->ackCount = client->nextAckCount;
+        }
+        client->nextAckSequence = 0;
+
+        if (!client->cancelled)
+        {
+            queueCount(client, FRAME_ACK, acked);
+        }
+        flushClient(client);
+    }
+}
+
+// Parses as much of the buffered input as possible, orders are handed to the
+// cooks as soon as their record is in, before the rest of the frame arrives.
+// Returns -1 if the client was released for breaking the protocol.
+int takeOrders(client_t *client)
+{
+    int offset = 0;
+    int receivedOrders = client->receivedOrders;
+    char busy[BUFFER_SIZE / ORDER_RECORD_SIZE * BUSY_RECORD_SIZE];
+    int busyLength = 0;
+    while (!client->cancelled)
+    {
+        int available = client->buffered - offset;
+
+        if (client->frameType == 0)
+        {
+            if (available < FRAME_HEADER_SIZE)
+            {
+                break;
+            }
+
+            FrameHeader header;
+            decodeFrameHeader(client->buffer + offset, &header);
+            if (!isValidFrame(&header, 1) || (client->ended && header.type != FRAME_CANCEL))
+            {
+                logMessage(LOG_INFO, "Client %s:%d sent an invalid frame (version %d, type %d, length %u)\n", inet_ntoa(client->address.sin_addr), ntohs(client->address.sin_port), header.version, header.type, header.length);
+
+                releaseClient(client);
+                return -1;
+            }
+            offset += FRAME_HEADER_SIZE;
+            client->frameType = header.type;
+            client->frameLeft = header.length;
+        }
+        else if (client->frameType == FRAME_ORDERS)
+        {
+            if (client->frameLeft == 0)
+            {
+                client->frameType = 0;
+                continue;
+            }
+
+            if (available < ORDER_RECORD_SIZE)
+            {
+                break;
+            }
+
+            // Every order makes an ACK or BUSY frame, none are made while the client leaves them unread
+            if (client->outboxed >= OUTBOX_SIZE)
+            {
+                setClientPaused(client, 1);
+                break;
+            }
+
+            // Once the shop drains, orders from connected clients are turned away too
+            if (draining)
+            {
+                encodeBusy(busy + busyLength, decodeInt(client->buffer + offset));
+                busyLength += BUSY_RECORD_SIZE;
+                offset += ORDER_RECORD_SIZE;
+                client->frameLeft -= ORDER_RECORD_SIZE;
+                client->rejectedOrders++;
+                rejectedOrders++;
+                continue;
+            }
+
+            // The ring queues are bounded, so orders beyond their capacity stay in the
+            // client buffer and the client is not read until finished orders make room
+            if (statGet(&orderStats, STAT_RECEIVED) - collectedOrders >= ORDER_QUEUE_CAPACITY)
+            {
+                setClientPaused(client, 1);
+                break;
+            }
+
+            // Past the admission bound the policy decides, so accepted orders never wait behind an unbounded queue
+            if (queuedOrders() >= maxQueuedOrders)
+            {
+                if (admissionPolicy == ADMIT_BLOCK)
+                {
+                    setClientPaused(client, 1);
+                    break;
+                }
+                if (admissionPolicy != ADMIT_SHED || !shedOldestOrder())
+                {
+                    encodeBusy(busy + busyLength, decodeInt(client->buffer + offset));
+                    busyLength += BUSY_RECORD_SIZE;
+                    offset += ORDER_RECORD_SIZE;
+                    client->frameLeft -= ORDER_RECORD_SIZE;
+                    client->rejectedOrders++;
+                    rejectedOrders++;
+                    continue;
+                }
+            }
+
+            Order *order = poolAlloc(&orderPool, &frontEndCache);
+            if (order == NULL)
+            {
+                perror("poolAlloc");
+                break;
+            }
+            order->customerId = decodeInt(client->buffer + offset);
+            order->p = decodeInt(client->buffer + offset + 4);
+            order->q = decodeInt(client->buffer + offset + 8);
+            order->client = client;
+            order->token = &client->token;
+            order->stamps[STAMP_RECEIVED] = currentMicros();
+            order->dropped = 0;
+            offset += ORDER_RECORD_SIZE;
+            client->frameLeft -= ORDER_RECORD_SIZE;
+
+            long long sequence = 0;
+            if (journalPath != NULL)
+            {
+                order->journalId = nextJournalId++;
+                sequence = journalAppend(&journal, JOURNAL_RECEIVED, order->journalId, order->customerId, order->p, order->q);
+            }
+            if (sequence == -1)
+            {
+                // An order that is not journaled cannot be acknowledged as durable, it is turned away instead
+                encodeBusy(busy + busyLength, order->customerId);
+                busyLength += BUSY_RECORD_SIZE;
+                client->rejectedOrders++;
+                rejectedOrders++;
+                poolFree(&orderPool, &frontEndCache, order);
+                continue;
+            }
+
+            client->receivedOrders++;
+            if (journalPath != NULL)
+            {
+                deferAck(client, sequence);
+            }
+
+            advanceOrders(STAT_RECEIVED);
+            ringEnqueue(&orders, order);
+            notifyCooks(0);
+            logMessage(LOG_DEBUG, "Put order from client %d from (%d, %d) in queue\n", order->customerId, order->p, order->q);
+        }
+        else
+        {
+            // Control frames are handled once their whole payload is in
+            if (available < (int)client->frameLeft)
+            {
+                break;
+            }
+
+            if (client->frameType == FRAME_END)
+            {
+                int sentOrders = decodeInt(client->buffer + offset);
+                if (sentOrders != client->receivedOrders + client->rejectedOrders)
+                {
+                    logMessage(LOG_INFO, "Client %s:%d sent %d orders but %d arrived\n", inet_ntoa(client->address.sin_addr), ntohs(client->address.sin_port), sentOrders, client->receivedOrders + client->rejectedOrders);
+                }
+                client->ended = 1;
+            }
+            else if (client->frameType == FRAME_CANCEL)
+            {
+                logMessage(LOG_INFO, "Client %s:%d cancelled orders\n", inet_ntoa(client->address.sin_addr), ntohs(client->address.sin_port));
+
+                client->cancelled = 1;
+                cancelOrders(client);
+            }
+            offset += client->frameLeft;
+            client->frameLeft = 0;
+            client->frameType = 0;
+        }
+    }
+
+    if (client->cancelled)
+    {
+        client->buffered = 0;
+        return 0;
+    }
+
+    memmove(client->buffer, client->buffer + offset, client->buffered - offset);
+    client->buffered -= offset;
+
+    if (client->receivedOrders != receivedOrders && journalPath == NULL)
+    {
+        queueCount(client, FRAME_ACK, client->receivedOrders);
+    }
+    if (busyLength > 0)
+    {
+        queueFrame(client, FRAME_BUSY, busy, busyLength);
+    }
+    return 0;
+}
+
+// Frames the drain still has to send before the shop exits
+int hasQueuedFrames()
+{
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        if (clients[i] != NULL && clients[i]->socket != -1 && clients[i]->outboxed > 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void resumeClients()
+{
+    for (int i = 0; i < MAX_CLIENTS && pausedClients > 0; i++)
+    {
+        client_t *client = clients[i];
+        if (client == NULL || !client->paused)
+        {
+            continue;
+        }
+        // takeOrders pauses it again if the kitchen still has no room
+        setClientPaused(client, 0);
+        if (takeOrders(client) == -1)
+        {
+            continue;
+        }
+        flushClient(client);
+    }
+}
+
+void readClient(client_t *client)
+{
+    while (client->socket != -1)
+    {
+        if (client->buffered == sizeof(client->buffer))
+        {
+            // Stop reading until finished orders make room in the kitchen
+            setClientPaused(client, 1);
+            return;
+        }
+
+        int bytesRead = read(client->socket, client->buffer + client->buffered, sizeof(client->buffer) - client->buffered);
+        if (bytesRead == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                return;
+            }
+            perror("Could not read from socket");
+            releaseClient(client);
+            return;
+        }
+
+        if (bytesRead == 0)
+        {
+            logMessage(LOG_INFO, "Client %s:%d disconnected\n", inet_ntoa(client->address.sin_addr), ntohs(client->address.sin_port));
+
+            releaseClient(client);
+            return;
+        }
+
+        client->buffered += bytesRead;
+        if (takeOrders(client) == -1)
+        {
+            return;
+        }
+        serveIfDone(client);
+        if (flushClient(client) == -1 || client->paused)
+        {
+            return;
+        }
+    }
+}
+
+void collectFinishedOrders()
+{
+    uint64_t count;
+    read(finishedOrdersFd, &count, sizeof(count));
+
+    Order *order;
+    while ((order = ringDequeue(&finishedOrders)) != NULL)
+    {
+        client_t *client = order->client;
+        int dropped = order->dropped;
+        char record[BUSY_RECORD_SIZE];
+        if (dropped)
+        {
+            encodeBusy(record, order->customerId);
+        }
+        else
+        {
+            encodeInt(record, order->customerId);
+        }
+        if (journalPath != NULL)
+        {
+            journalAppend(&journal, JOURNAL_FINISHED, order->journalId, order->customerId, order->p, order->q);
+        }
+        collectedOrders++;
+        poolFree(&orderPool, &frontEndCache, order);
+
+        // Orders recovered from the journal have no client left to tell
+        if (client == NULL)
+        {
+            continue;
+        }
+        client->finishedOrders++;
+        if (client->cancelled)
+        {
+            cancelledPending--;
+        }
+
+        if (client->socket == -1)
+        {
+            if (client->finishedOrders == client->receivedOrders)
+            {
+                releaseClient(client);
+            }
+            continue;
+        }
+
+        if (!client->cancelled)
+        {
+            queueFrame(client, dropped ? FRAME_BUSY : FRAME_DELIVERED, record, dropped ? BUSY_RECORD_SIZE : DELIVERED_RECORD_SIZE);
+        }
+        serveIfDone(client);
+        flushClient(client);
+    }
+
+    if (pausedClients > 0)
+    {
+        resumeClients();
+    }
+}
+// Opens the journal and puts the orders a crash left unfinished back in the
+// queues, before the kitchen starts. Cooked ones go straight to the couriers.
+int recoverOrders()
+{
+    journalFd = eventfd(0, EFD_NONBLOCK);
+    JournalRecord *live;
+    int liveCount;
+    if (journalFd == -1 || openJournal(&journal, journalPath, journalFd, JOURNAL_COMPACT_SIZE, &live, &liveCount, &nextJournalId) == -1)
+    {
+        perror("Could not open the journal");
+        return -1;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &journalFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, journalFd, &event);
+
+    int recovered = 0;
+    int cooked = 0;
+    long long now = currentMicros();
+    for (; recovered < liveCount && recovered < ORDER_QUEUE_CAPACITY; recovered++)
+    {
+        JournalRecord *record = &live[recovered];
+        Order *order = poolAlloc(&orderPool, &frontEndCache);
+        if (order == NULL)
+        {
+            // The rest stay in the journal for the next start
+            perror("poolAlloc");
+            break;
+        }
+        order->customerId = record->customerId;
+        order->p = record->p;
+        order->q = record->q;
+        order->client = NULL;
+        order->token = &neverCancelled;
+        order->dropped = 0;
+        order->journalId = record->id;
+        for (int i = 0; i < STAMP_COUNT; i++)
+        {
+            order->stamps[i] = now;
+        }
+
+        advanceOrders(STAT_RECEIVED);
+        if (record->type == JOURNAL_COOKED)
+        {
+            advanceOrders(STAT_PREP_STARTED);
+            advanceOrders(STAT_PREPARED);
+            advanceOrders(STAT_OVEN_IN);
+            advanceOrders(STAT_COOKED);
+            ringEnqueue(&readyOrders, order);
+            cooked++;
+        }
+        else
+        {
+            ringEnqueue(&orders, order);
+        }
+    }
+    free(live);
+
+    logMessage(LOG_INFO, "Journal %s: recovered %d orders, %d of them cooked\n", journalPath, recovered, cooked);
+    if (recovered < liveCount)
+    {
+        logMessage(LOG_INFO, "Journal %s: %d more orders left for the next start\n", journalPath, liveCount - recovered);
+    }
+    return 0;
+}
+// --- front end ---
+
+void printUsage(char *program)
+{
+    fprintf(stderr, "Usage: %s [-l logLevel] [-i statsInterval] [-a policy] [-Q maxQueued] [-W deadline] [-j journal] [-O ovens] [-M cpuList] [-C cpuList] [-D cpuList] [-n] [port] [cookPoolSize] [deliveryPoolSize] [deliverySpeed]\n", program);
+    fprintf(stderr, "  -l logLevel       0 errors, 1 client events and stats, 2 every kitchen event (default)\n");
+    fprintf(stderr, "  -i statsInterval  seconds between queue and stage latency dumps, 0 to disable (default %d)\n", DEFAULT_STATS_INTERVAL);
+    fprintf(stderr, "                    SIGUSR1 dumps them at any time\n");
+    fprintf(stderr, "  -a policy         what to do with orders past -Q: block reading (default), reject, deadline or shed\n");
+    fprintf(stderr, "                    turned away orders get a busy reply with a retry time\n");
+    fprintf(stderr, "  -Q maxQueued      orders waiting for a cook before the policy applies (default %d)\n", ORDER_QUEUE_CAPACITY);
+    fprintf(stderr, "  -W deadline       ms an order may wait for a cook under the deadline policy (default %d)\n", DEFAULT_QUEUE_DEADLINE);
+    fprintf(stderr, "  -j journal        journal orders to this file, unfinished ones are cooked again after a crash\n");
+    fprintf(stderr, "  -O ovens          ovens as capacity:doors:paddles, comma separated (default %d:%d:%d)\n", OVEN_CAPACITY, OVEN_DOORS, OVEN_APARATUS);
+    fprintf(stderr, "                    doors and paddles may be left out, at most %d ovens\n", MAX_OVENS);
+    fprintf(stderr, "  -M cpuList        pin the manager thread, lists look like 0-3,8\n");
+    fprintf(stderr, "  -C cpuList        pin cooks round-robin over the list\n");
+    fprintf(stderr, "  -D cpuList        pin couriers round-robin over the list\n");
+    fprintf(stderr, "  -n                cooks allocate their own queues on their node after pinning\n");
+    fprintf(stderr, "  cookPoolSize may be auto, one cook per CPU of -C or per online CPU\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int logLevel = LOG_DEBUG;
+    int option;
+    char *cpuLists[3] = {NULL, NULL, NULL};
+    OvenSpec defaultOven = {OVEN_CAPACITY, OVEN_DOORS, OVEN_APARATUS};
+    ovenSpecs[0] = defaultOven;
+    while ((option = getopt(argc, argv, "l:i:a:Q:W:j:O:M:C:D:n")) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            admissionPolicy = -1;
+            for (int i = 0; i < (int)(sizeof(admissionPolicyNames) / sizeof(admissionPolicyNames[0])); i++)
+            {
+                if (strcmp(optarg, admissionPolicyNames[i]) == 0)
+                {
+                    admissionPolicy = i;
+                }
+            }
+            if (admissionPolicy == -1)
+            {
+                fprintf(stderr, "Admission policy must be one of block, reject, deadline, shed\n");
+                return 1;
+            }
+            break;
+        case 'j':
+            journalPath = optarg;
+            break;
+        case 'O':
+            configuredOvens = parseOvenSpecs(optarg, ovenSpecs, MAX_OVENS, defaultOven);
+            if (configuredOvens == -1)
+            {
+                fprintf(stderr, "Ovens must look like 6:2:3,4:1:2 with at most %d ovens\n", MAX_OVENS);
+                return 1;
+            }
+            break;
+        case 'Q':
+            maxQueuedOrders = atoi(optarg);
+            break;
+        case 'W':
+            queueDeadline = atoi(optarg);
+            break;
+        case 'M':
+            cpuLists[0] = optarg;
+            break;
+        case 'C':
+            cpuLists[1] = optarg;
+            break;
+        case 'D':
+            cpuLists[2] = optarg;
+            break;
+        case 'n':
+            numaLocal = 1;
+            break;
+        case 'l':
+            logLevel = atoi(optarg);
+            break;
+        case 'i':
+            statsInterval = atoi(optarg);
+            break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 4)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    int port = atoi(argv[optind + 0]);
+    CpuList *poolCpus[3] = {&managerCpus, &cookCpus, &courierCpus};
+    for (int i = 0; i < 3; i++)
+    {
+        if (cpuLists[i] == NULL)
+        {
+            continue;
+        }
+        if (parseCpuList(cpuLists[i], poolCpus[i]) == -1 || !cpuListAllowed(poolCpus[i]))
+        {
+            fprintf(stderr, "CPU list %s is malformed or has CPUs this process cannot use\n", cpuLists[i]);
+            return 1;
+        }
+    }
+
+    // "auto" gives one cook per CPU of the cook list, or per online CPU
+    int autoCookPool = strcmp(argv[optind + 1], "auto") == 0;
+    cookPoolSize = autoCookPool ? (cookCpus.count > 0 ? cookCpus.count : onlineCpuCount()) : atoi(argv[optind + 1]);
+    deliveryPoolSize = atoi(argv[optind + 2]);
+    deliverySpeed = atoi(argv[optind + 3]);
+
+    if (logLevel < LOG_ERROR || logLevel > LOG_DEBUG)
+    {
+        fprintf(stderr, "Log level must be in range 0-2\n");
+        return 1;
+    }
+
+    if (statsInterval < 0 || statsInterval > 3600)
+    {
+        fprintf(stderr, "Stats interval must be in range 0-3600\n");
+        return 1;
+    }
+
+    if (maxQueuedOrders < 1 || maxQueuedOrders > ORDER_QUEUE_CAPACITY)
+    {
+        fprintf(stderr, "Max queued orders must be in range 1-%d\n", ORDER_QUEUE_CAPACITY);
+        return 1;
+    }
+
+    if (queueDeadline < 1 || queueDeadline > 3600000)
+    {
+        fprintf(stderr, "Queue deadline must be in range 1-3600000\n");
+        return 1;
+    }
 
     if (port < 1024 || port > 65535)
     {
@@ -736,6 +2043,12 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (initLogger(logFd, logLevel) == -1)
+    {
+        fprintf(stderr, "Could not start the logger\n");
+        return 1;
+    }
+
     serverSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (serverSocket == 0)
     {
@@ -771,131 +2084,210 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    printf("Server listening on port %d\n", port);
-    dprintf(logFd, "[%s] Server listening on port %d\n", getTimestamp(), port);
-
-    while (1)
+    logMessage(LOG_INFO, "Server listening on port %d\n", port);
+    logMessage(LOG_INFO, "%d cooks%s, %d couriers, %d online CPUs\n", cookPoolSize, autoCookPool ? " (auto)" : "", deliveryPoolSize, onlineCpuCount());
+    logMessage(LOG_INFO, "Admission policy %s past %d queued orders\n", admissionPolicyNames[admissionPolicy], maxQueuedOrders);
+    if (managerCpus.count + cookCpus.count + courierCpus.count > 0)
     {
-        printf("Waiting new orders...\n");
-        dprintf(logFd, "[%s] Waiting new orders...\n", getTimestamp());
+        logMessage(LOG_INFO, "Pinned over %d manager, %d cook and %d courier CPUs\n", managerCpus.count, cookCpus.count, courierCpus.count);
+    }
 
-        client_t client;
-        socklen_t addrLen = sizeof(client.address);
-        client.socket = accept(serverSocket, (struct sockaddr *)&client.address, &addrLen);
-        if (client.socket == -1)
-        {
-            perror("Accept failed");
-        }
+    fcntl(serverSocket, F_SETFL, fcntl(serverSocket, F_GETFL) | O_NONBLOCK);
 
-        printf("Accepted orders from %s:%d\n", inet_ntoa(client.address.sin_addr), ntohs(client.address.sin_port));
-        dprintf(logFd, "[%s] Accepted orders from %s:%d\n", getTimestamp(), inet_ntoa(client.address.sin_addr), ntohs(client.address.sin_port));
+    epollFd = epoll_create1(0);
+    finishedOrdersFd = eventfd(0, EFD_NONBLOCK);
+    if (epollFd == -1 || finishedOrdersFd == -1)
+    {
+        perror("Could not create event loop");
+        close(serverSocket);
+        return 1;
+    }
 
-        printf("Shop is closed for new orders\n");
-        dprintf(logFd, "[%s] Shop is closed for new orders\n", getTimestamp());
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &serverSocket;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, serverSocket, &event);
+    event.events = EPOLLIN;
+    event.data.ptr = &finishedOrdersFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, finishedOrdersFd, &event);
+    event.events = EPOLLIN;
+    event.data.ptr = &signalFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+
+    pthread_mutex_init(&mutexKitchen, NULL);
+    pthread_mutex_init(&mutexCouriers, NULL);
+    pthread_mutex_init(&mutexStatus, NULL);
+    pthread_condattr_t monotonicClock;
+    pthread_condattr_init(&monotonicClock);
+    pthread_condattr_setclock(&monotonicClock, CLOCK_MONOTONIC);
+    pthread_cond_init(&condKitchen, NULL);
+    pthread_cond_init(&condOvenWatch, &monotonicClock);
+    pthread_cond_init(&condStatus, &monotonicClock);
+    pthread_condattr_destroy(&monotonicClock);
+    pthread_cond_init(&condCouriers, NULL);
+
+    initObjectPool(&orderPool, sizeof(Order));
+    initObjectPool(&ovenEntryPool, sizeof(OrderWithTime));
+    initPoolCache(&frontEndCache);
+    initPoolCache(&frontEndEntryCache);
+    atomic_init(&neverCancelled.cancelled, 0);
+    atomic_init(&cancelledOrders, 0);
+    if (initOvenGroup(&ovens, ovenSpecs, configuredOvens) == -1)
+    {
+        perror("Could not allocate ovens");
+        close(serverSocket);
+        return 1;
+    }
+    initStatsBlock(&orderStats);
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        initHistogram(&stageLatency[i]);
+    }
+    if (initRingQueue(&orders, ORDER_QUEUE_CAPACITY) == -1 ||
+        initRingQueue(&readyOrders, ORDER_QUEUE_CAPACITY) == -1 ||
+        initRingQueue(&finishedOrders, ORDER_QUEUE_CAPACITY) == -1 ||
+        initRingQueue(&preparedOrders, ORDER_QUEUE_CAPACITY) == -1 ||
+        initRouteBoard(&readyBoard, ORDER_QUEUE_CAPACITY) == -1)
+    {
+        perror("Could not allocate order queues");
+        close(serverSocket);
+        return 1;
+    }
 
-        connected = 1;
+    cookQueues = malloc(cookPoolSize * sizeof(CookQueues));
+    for (int i = 0; cookQueues != NULL && !numaLocal && i < cookPoolSize; i++)
+    {
+        if (initWorkDeque(&cookQueues[i].prepWork, COOK_DEQUE_CAPACITY) == -1 ||
+            initWorkDeque(&cookQueues[i].ovenWork, COOK_DEQUE_CAPACITY) == -1)
+        {
+            cookQueues = NULL;
+        }
+    }
+    if (cookQueues == NULL)
+    {
+        perror("Could not allocate cook queues");
+        close(serverSocket);
+        return 1;
+    }
 
-        totalOrders = 1;
-        cookedOrders = 0;
-        ordersToBeDelivered = 0;
-        ordersWaitingForDelivery = 0;
-        ordersWaitingForOven = 0;
-        ordersToBePrepared = 0;
-        deliveredOrders = 0;
-        ordersInDeliveryCount = 0;
+    if (journalPath != NULL && recoverOrders() == -1)
+    {
+        close(serverSocket);
+        return 1;
+    }
 
-        sem_init(&semOvenAparatus, 0, OVEN_APARATUS);
-        sem_init(&semOvenDoors, 0, OVEN_DOORS);
-        sem_init(&semReadyOrders, 0, 0);
-        pthread_mutex_init(&mutexOven, NULL);
-        pthread_mutex_init(&mutexCookedOrders, NULL);
-        pthread_mutex_init(&mutexDeliveredOrders, NULL);
-        pthread_mutex_init(&mutexInDeliveryOrders, NULL);
-        pthread_mutex_init(&mutexOrdersWaitingForOven, NULL);
-        pthread_mutex_init(&mutexOrdersToBePrepared, NULL);
-        pthread_mutex_init(&mutexOrdersInPreparation, NULL);
+    // The kitchen is shared by every client and runs for the life of the server
+    pthread_attr_t managerAttr;
+    pthread_attr_init(&managerAttr);
+    if (managerCpus.count > 0)
+    {
+        setThreadCpu(&managerAttr, &managerCpus, 0);
+    }
+    pthread_create(&managerThread, &managerAttr, manager, NULL);
+    pthread_attr_destroy(&managerAttr);
+    if (numaLocal)
+    {
+        pthread_barrier_init(&cookQueuesReady, NULL, cookPoolSize);
+    }
+    startPool(&cookPool, cookPoolSize, cook, &cookCpus);
+    startPool(&courierPool, deliveryPoolSize, courier, &courierCpus);
 
-        initCircularQueue(&orders);
-        initCircularQueue(&readyOrders);
-        initCircularQueue(&ordersInDelivery);
+    connected = 1;
 
-        pthread_create(&managerThread, NULL, manager, &client);
+    logMessage(LOG_INFO, "Waiting new orders...\n");
 
-        cookThreads = malloc(cookPoolSize * sizeof(pthread_t));
-        cookThreadsArgs = malloc(cookPoolSize * sizeof(int));
-        for (int i = 0; i < cookPoolSize; i++)
+    struct epoll_event events[MAX_EVENTS];
+    while (shopOpen)
+    {
+        int eventCount = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if (eventCount == -1)
         {
-            cookThreadsArgs[i] = i;
-            pthread_create(&cookThreads[i], NULL, cook, &cookThreadsArgs[i]);
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
         }
 
-        courierThreads = malloc(deliveryPoolSize * sizeof(pthread_t));
-        courierThreadsArgs = malloc(deliveryPoolSize * sizeof(int));
-        for (int i = 0; i < deliveryPoolSize; i++)
+        // Finished orders and ACKs may release clients, so they are handled after the batch
+        int ordersFinished = 0;
+        int ordersDurable = 0;
+        for (int i = 0; i < eventCount; i++)
         {
-            courierThreadsArgs[i] = i;
-            pthread_create(&courierThreads[i], NULL, courier, &courierThreadsArgs[i]);
+            if (events[i].data.ptr == &serverSocket)
+            {
+                acceptClients();
+            }
+            else if (events[i].data.ptr == &finishedOrdersFd)
+            {
+                ordersFinished = 1;
+            }
+            else if (events[i].data.ptr == &journalFd)
+            {
+                ordersDurable = 1;
+            }
+            else if (events[i].data.ptr == &signalFd)
+            {
+                struct signalfd_siginfo info;
+                while (read(signalFd, &info, sizeof(info)) == sizeof(info))
+                {
+                    if (info.ssi_signo == SIGUSR1)
+                    {
+                        dumpStats();
+                    }
+                    else
+                    {
+                        handle_sigint(info.ssi_signo);
+                    }
+                }
+            }
+            else
+            {
+                client_t *client = events[i].data.ptr;
+                if ((events[i].events & EPOLLOUT) && flushClient(client) == -1)
+                {
+                    continue;
+                }
+                if (!(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                {
+                    continue;
+                }
+
+                // Paused clients only report hang ups and errors
+                if (client->paused)
+                {
+                    releaseClient(client);
+                }
+                else
+                {
+                    readClient(client);
+                }
+            }
         }
 
-        pthread_join(managerThread, NULL);
-        for (int i = 0; i < cookPoolSize; i++)
+        if (ordersDurable)
         {
-            pthread_join(cookThreads[i], NULL);
+            ackDurableOrders();
         }
-        for (int i = 0; i < deliveryPoolSize; i++)
+        if (ordersFinished)
         {
-            pthread_join(courierThreads[i], NULL);
+            collectFinishedOrders();
         }
-
-        printf("\nAll threads are done\n");
-        dprintf(logFd, "[%s] All threads are done\n", getTimestamp());
-
-        printf("Stats:\n");
-        dprintf(logFd, "[%s] Stats:\n", getTimestamp());
-
-        for (int i = 0; i < cookPoolSize; i++)
+        if (outboxDrained)
         {
-            printf("Cook %d prepared %d orders\n", i, cookThreadsArgs[i]);
-            dprintf(logFd, "[%s] Cook %d prepared %d orders\n", getTimestamp(), i, cookThreadsArgs[i]);
+            outboxDrained = 0;
+            resumeClients();
         }
 
-        for (int i = 0; i < deliveryPoolSize; i++)
+        if (draining && collectedOrders + cancelledPending == statGet(&orderStats, STAT_RECEIVED) && !hasQueuedFrames())
         {
-            printf("Courier %d delivered %d orders\n", i, courierThreadsArgs[i]);
-            dprintf(logFd, "[%s] Courier %d delivered %d orders\n", getTimestamp(), i, courierThreadsArgs[i]);
+            logMessage(LOG_INFO, "All orders are cooked and delivered\n");
+            break;
         }
-
-        free(cookThreads);
-        free(courierThreads);
-        free(cookThreadsArgs);
-        free(courierThreadsArgs);
-
-        sem_destroy(&semOvenAparatus);
-        sem_destroy(&semOvenDoors);
-        sem_destroy(&semReadyOrders);
-        pthread_mutex_destroy(&mutexOven);
-        pthread_mutex_destroy(&mutexCookedOrders);
-        pthread_mutex_destroy(&mutexDeliveredOrders);
-        pthread_mutex_destroy(&mutexInDeliveryOrders);
-        pthread_mutex_destroy(&mutexOrdersWaitingForOven);
-        pthread_mutex_destroy(&mutexOrdersToBePrepared);
-        pthread_mutex_destroy(&mutexOrdersInPreparation);
-
-        clearCircularQueue(&orders);
-        clearCircularQueue(&readyOrders);
-        clearCircularQueue(&ordersInDelivery);
-
-        printf("Done serving to %s:%d\n\n", inet_ntoa(client.address.sin_addr), ntohs(client.address.sin_port));
-        dprintf(logFd, "[%s] Done serving to %s:%d\n\n", getTimestamp(), inet_ntoa(client.address.sin_addr), ntohs(client.address.sin_port));
-
-        write(client.socket, "Thank you for your order\n", 26);
-        close(client.socket);
-
-        connected = 0;
     }
 
-    close(serverSocket);
-    close(logFd);
+    cleanup();
 
     return 0;
 }
@@ -0,0 +1,940 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "oven.h"
+#include "ovengroup.h"
+#include "route.h"
+#include "histogram.h"
+
+// Same as PideShop.c
+#define DELIVERY_ORDER_COUNT 3
+#define OVEN_CAPACITY 6
+#define OVEN_APARATUS 3
+#define OVEN_DOORS 2
+#define COOK_BATCH 8
+#define DEFAULT_QUEUE_DEADLINE 1000
+
+#define ADMIT_BLOCK 0
+#define ADMIT_REJECT 1
+#define ADMIT_DEADLINE 2
+#define ADMIT_SHED 3
+
+#define DEFAULT_ORDERS 10000
+#define DEFAULT_PREPARE_MICROS 1500
+#define DEFAULT_TOOL_MICROS 20
+#define DEFAULT_TOWN_SIZE 100
+#define MAX_SWEEP_VALUES 32
+
+// Discrete-event run of the PideShop kitchen on a virtual clock in microseconds.
+// Cooks, ovens and couriers follow the server's rules with its own Oven,
+// OvenGroup, RouteBoard and planRoute:
+// - orders are admitted under the server's policies, -a, -Q and -W mean the same
+// - a cook takes work from its own deque, then a fair share of the shared
+//   queue, then steals, and loads pides from its own deque before stealing
+//   the oldest of the other cooks
+// - after every preparation a cook unloads every oven with done pides and
+//   loads the ovens ovenGroupReserve picks, holding a door and a paddle of
+//   the oven it is at for toolMicros per pide moved
+// - idle cooks are woken where the server notifies them, one watches the ovens
+// - couriers leave with DELIVERY_ORDER_COUNT orders or when fewer are left to
+//   pick up, travel takes the whole seconds the couriers sleep for
+// Preparation times are drawn uniformly around the mean instead of computing
+// the pseudo-inverse, baking takes half of it like in the server.
+
+#define EVENT_ARRIVAL 0
+#define EVENT_PREPARED 1
+#define EVENT_BAKED 2
+#define EVENT_COURIER_BACK 3
+#define EVENT_WAKE 4
+#define EVENT_OVEN_DONE 5
+
+#define COOK_IDLE 0
+#define COOK_BUSY 1
+#define COOK_WAITING_OVEN 2
+
+#define VISIT_UNLOAD 0
+#define VISIT_LOAD 1
+
+typedef struct
+{
+    long long time;
+    long sequence; // keeps events at the same time in the order they were scheduled
+    int type;
+    int index;
+} Event;
+
+typedef struct
+{
+    long long arrival;
+    long long admitted;
+    long long prepTime;
+    int p;
+    int q;
+} SimOrder;
+
+typedef struct
+{
+    Event *events;
+    int count;
+    int capacity;
+    long sequence;
+} EventQueue;
+
+// Order indexes, the owner works at the bottom and thieves take from the top like WorkDeque
+typedef struct
+{
+    int *items;
+    int top;
+    int bottom;
+    int capacity;
+} SimDeque;
+
+typedef struct
+{
+    SimDeque prepWork;
+    SimDeque ovenWork;
+    int state;
+    int held;       // oven whose door and paddle the cook holds, -1 for none
+    int visitOven;  // oven the cook is at or waiting for
+    int visitKind;
+    int pide;       // order it loads on a VISIT_LOAD
+    int preparing;
+    int scan;       // next oven to check for done pides
+    long long waitStart;
+} SimCook;
+
+// Every visit takes a door and a paddle of the oven, so an oven lets
+// min(doors, paddles) cooks in at once. Waiters are let in first come first served.
+typedef struct
+{
+    int free;
+    int *waiters;
+    int waitHead;
+    int waitTail;
+} OvenTools;
+
+typedef struct
+{
+    int cooks;
+    int couriers;
+    int speed;
+} SimConfig;
+
+typedef struct
+{
+    int count;
+    OvenSpec specs[MAX_OVENS];
+    char text[128];
+} OvenGroupSpec;
+
+typedef struct
+{
+    int policy;
+    int maxQueued;
+    int deadlineMicros;
+    int toolMicros;
+} SimRules;
+
+// Everything one run changes, the orders are shared by every run of a sweep
+typedef struct
+{
+    SimConfig config;
+    SimRules rules;
+    SimOrder *orders;
+    int orderCount;
+    EventQueue queue;
+    int *shared; // the orders ring queue of the server
+    int sharedHead;
+    int sharedTail;
+    int *blocked; // arrivals the blocking policy has not read yet
+    int blockedHead;
+    int blockedTail;
+    SimCook *cooks;
+    int *idle;
+    int idleCount;
+    OvenGroup ovens;
+    OvenTools *tools;
+    RouteBoard board;
+    int idleCouriers;
+    int received;
+    int prepStarted;
+    int waitingPides; // prepared and in a cook's deque, not yet taken to an oven
+    int pickedUp; // dropped orders count as picked up, like in the server
+    int delivered;
+    int rejected;
+    int shed;
+    int expired;
+    long long toolWaitMicros;
+    long toolVisits;
+    long long lastDelivery;
+    Histogram latency;
+} Simulation;
+
+static unsigned long long rngState;
+
+// xorshift64, so a seed gives the same orders on every machine
+static double nextRandom()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return (rngState >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void *allocOrDie(size_t size)
+{
+    void *memory = malloc(size);
+    if (memory == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    return memory;
+}
+
+static int isEarlier(Event *a, Event *b)
+{
+    return a->time < b->time || (a->time == b->time && a->sequence < b->sequence);
+}
+
+static void schedule(EventQueue *queue, long long time, int type, int index)
+{
+    if (queue->count == queue->capacity)
+    {
+        queue->capacity *= 2;
+        queue->events = realloc(queue->events, queue->capacity * sizeof(Event));
+        if (queue->events == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    Event event = {time, queue->sequence++, type, index};
+    int i = queue->count++;
+    while (i > 0)
+    {
+        Event *parent = &queue->events[(i - 1) / 2];
+        if (isEarlier(parent, &event))
+        {
+            break;
+        }
+        queue->events[i] = *parent;
+        i = (i - 1) / 2;
+    }
+    queue->events[i] = event;
+}
+
+static Event nextEvent(EventQueue *queue)
+{
+    Event first = queue->events[0];
+    Event last = queue->events[--queue->count];
+    int i = 0;
+    while (2 * i + 1 < queue->count)
+    {
+        int child = 2 * i + 1;
+        if (child + 1 < queue->count && isEarlier(&queue->events[child + 1], &queue->events[child]))
+        {
+            child++;
+        }
+        if (!isEarlier(&queue->events[child], &last))
+        {
+            break;
+        }
+        queue->events[i] = queue->events[child];
+        i = child;
+    }
+    queue->events[i] = last;
+    return first;
+}
+
+static void initSimDeque(SimDeque *deque)
+{
+    deque->capacity = COOK_BATCH;
+    deque->items = allocOrDie(deque->capacity * sizeof(int));
+    deque->top = 0;
+    deque->bottom = 0;
+}
+
+static void simDequePush(SimDeque *deque, int index)
+{
+    if (deque->bottom == deque->capacity)
+    {
+        int count = deque->bottom - deque->top;
+        memmove(deque->items, deque->items + deque->top, count * sizeof(int));
+        deque->top = 0;
+        deque->bottom = count;
+        if (count * 2 > deque->capacity)
+        {
+            deque->capacity *= 2;
+            deque->items = realloc(deque->items, deque->capacity * sizeof(int));
+            if (deque->items == NULL)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+    }
+    deque->items[deque->bottom++] = index;
+}
+
+static int simDequePop(SimDeque *deque)
+{
+    return deque->bottom > deque->top ? deque->items[--deque->bottom] : -1;
+}
+
+static int simDequeSteal(SimDeque *deque)
+{
+    return deque->bottom > deque->top ? deque->items[deque->top++] : -1;
+}
+
+static int simDequeIsEmpty(SimDeque *deque)
+{
+    return deque->bottom == deque->top;
+}
+
+static long long travelTime(int fromP, int fromQ, int toP, int toQ, int deliverySpeed)
+{
+    return legCost(fromP, fromQ, toP, toQ) / (deliverySpeed * 10000) * 1000000LL;
+}
+
+// notifyCooks(0) of the server, one idle cook gets up
+static void wakeCook(Simulation *sim, long long now)
+{
+    if (sim->idleCount == 0)
+    {
+        return;
+    }
+    int cook = sim->idle[--sim->idleCount];
+    sim->cooks[cook].state = COOK_BUSY;
+    schedule(&sim->queue, now, EVENT_WAKE, cook);
+}
+
+static void admit(Simulation *sim, int index, long long now)
+{
+    sim->orders[index].admitted = now;
+    sim->received++;
+    sim->shared[sim->sharedTail++] = index;
+    wakeCook(sim, now);
+}
+
+// Orders admitted but not taken by a cook yet, like queuedOrders in the server
+static int queuedOrders(Simulation *sim)
+{
+    return sim->received - sim->prepStarted;
+}
+
+static void dropOrder(Simulation *sim)
+{
+    sim->pickedUp++;
+}
+
+static void arrive(Simulation *sim, int index, long long now)
+{
+    if (sim->rules.policy == ADMIT_BLOCK && (sim->blockedHead < sim->blockedTail || queuedOrders(sim) >= sim->rules.maxQueued))
+    {
+        sim->blocked[sim->blockedTail++] = index;
+        return;
+    }
+    if (queuedOrders(sim) >= sim->rules.maxQueued)
+    {
+        if (sim->rules.policy != ADMIT_SHED || sim->sharedHead == sim->sharedTail)
+        {
+            sim->rejected++;
+            return;
+        }
+        sim->sharedHead++;
+        sim->prepStarted++;
+        sim->shed++;
+        dropOrder(sim);
+    }
+    admit(sim, index, now);
+}
+
+// A cook took an order off the queue, so the blocking policy may read more
+static void admitBlocked(Simulation *sim, long long now)
+{
+    while (sim->blockedHead < sim->blockedTail && queuedOrders(sim) < sim->rules.maxQueued)
+    {
+        admit(sim, sim->blocked[sim->blockedHead++], now);
+    }
+}
+
+static int takePrepWork(Simulation *sim, int id, long long now)
+{
+    SimCook *cook = &sim->cooks[id];
+    int index = simDequePop(&cook->prepWork);
+    if (index != -1)
+    {
+        return index;
+    }
+
+    int batch[COOK_BATCH];
+    int share = (sim->sharedTail - sim->sharedHead) / sim->config.cooks;
+    int wanted = share < 1 ? 1 : share > COOK_BATCH ? COOK_BATCH : share;
+    int taken = 0;
+    while (taken < wanted && sim->sharedHead < sim->sharedTail)
+    {
+        batch[taken++] = sim->shared[sim->sharedHead++];
+    }
+    if (taken > 0)
+    {
+        for (int i = taken - 1; i > 0; i--)
+        {
+            simDequePush(&cook->prepWork, batch[i]);
+        }
+        if (taken > 1)
+        {
+            wakeCook(sim, now);
+        }
+        return batch[0];
+    }
+
+    for (int i = 1; i < sim->config.cooks; i++)
+    {
+        SimDeque *victim = &sim->cooks[(id + i) % sim->config.cooks].prepWork;
+        index = simDequeSteal(victim);
+        if (index != -1)
+        {
+            if (!simDequeIsEmpty(victim))
+            {
+                wakeCook(sim, now);
+            }
+            return index;
+        }
+    }
+    return -1;
+}
+
+static int takeOvenWork(Simulation *sim, int id)
+{
+    for (int i = 0; i < sim->config.cooks; i++)
+    {
+        int index = simDequeSteal(&sim->cooks[(id + i) % sim->config.cooks].ovenWork);
+        if (index != -1)
+        {
+            sim->waitingPides--;
+            return index;
+        }
+    }
+    return -1;
+}
+
+static int hasOvenWork(Simulation *sim, long long now)
+{
+    long long deadline = ovenGroupNextDeadline(&sim->ovens);
+    return (deadline != -1 && deadline <= now) || (sim->waitingPides > 0 && ovenGroupFreeSlots(&sim->ovens) > 0);
+}
+
+static void cookRun(Simulation *sim, int id, long long now);
+static void cookNextVisit(Simulation *sim, int id, long long now);
+
+// The cook has the door and paddle of its oven, moving every pide takes toolMicros
+static void atOven(Simulation *sim, int id, long long now)
+{
+    SimCook *cook = &sim->cooks[id];
+    KitchenOven *kitchenOven = &sim->ovens.ovens[cook->visitOven];
+    int moved = 0;
+    if (cook->visitKind == VISIT_UNLOAD)
+    {
+        void *data;
+        while ((data = ovenTakeReady(&kitchenOven->oven, now)) != NULL)
+        {
+            SimOrder *order = data;
+            routeBoardAdd(&sim->board, order->p, order->q, order);
+            moved++;
+        }
+        if (moved > 0 && sim->waitingPides > 0)
+        {
+            wakeCook(sim, now);
+        }
+    }
+    else
+    {
+        SimOrder *order = &sim->orders[cook->pide];
+        long long deadline = now + sim->rules.toolMicros + order->prepTime / 2;
+        ovenPut(&kitchenOven->oven, order, deadline);
+        schedule(&sim->queue, deadline, EVENT_BAKED, cook->pide);
+        moved = 1;
+    }
+    long long busy = (moved > 0 ? moved : 1) * (long long)sim->rules.toolMicros;
+    schedule(&sim->queue, now + busy, EVENT_OVEN_DONE, id);
+}
+
+static void releaseTools(Simulation *sim, int id, long long now)
+{
+    SimCook *cook = &sim->cooks[id];
+    if (cook->held == -1)
+    {
+        return;
+    }
+    OvenTools *tools = &sim->tools[cook->held];
+    cook->held = -1;
+    if (tools->waitHead == tools->waitTail)
+    {
+        tools->free++;
+        return;
+    }
+
+    int next = tools->waiters[tools->waitHead++];
+    SimCook *waiter = &sim->cooks[next];
+    waiter->state = COOK_BUSY;
+    waiter->held = waiter->visitOven;
+    sim->toolWaitMicros += now - waiter->waitStart;
+    sim->toolVisits++;
+    atOven(sim, next, now);
+}
+
+// A cook keeps the door and paddle of the oven it is at while it keeps working there
+static void visitOven(Simulation *sim, int id, int oven, int kind, long long now)
+{
+    SimCook *cook = &sim->cooks[id];
+    cook->visitOven = oven;
+    cook->visitKind = kind;
+    if (cook->held == oven)
+    {
+        atOven(sim, id, now);
+        return;
+    }
+    releaseTools(sim, id, now);
+
+    OvenTools *tools = &sim->tools[oven];
+    if (tools->free > 0 && tools->waitHead == tools->waitTail)
+    {
+        tools->free--;
+        cook->held = oven;
+        sim->toolVisits++;
+        atOven(sim, id, now);
+        return;
+    }
+    cook->state = COOK_WAITING_OVEN;
+    cook->waitStart = now;
+    if (tools->waitTail == sim->config.cooks)
+    {
+        memmove(tools->waiters, tools->waiters + tools->waitHead, (tools->waitTail - tools->waitHead) * sizeof(int));
+        tools->waitTail -= tools->waitHead;
+        tools->waitHead = 0;
+    }
+    tools->waiters[tools->waitTail++] = id;
+}
+
+// Done pides come out of every oven first, starting at the cook's own, then
+// the allocator picks the oven for every pide
+static void cookNextVisit(Simulation *sim, int id, long long now)
+{
+    SimCook *cook = &sim->cooks[id];
+    while (cook->scan < sim->ovens.count)
+    {
+        int oven = (id + cook->scan++) % sim->ovens.count;
+        long long deadline = ovenNextDeadline(&sim->ovens.ovens[oven].oven);
+        if (deadline != -1 && deadline <= now)
+        {
+            visitOven(sim, id, oven, VISIT_UNLOAD, now);
+            return;
+        }
+    }
+
+    int slot = ovenGroupReserve(&sim->ovens);
+    if (slot != -1)
+    {
+        cook->pide = takeOvenWork(sim, id);
+        if (cook->pide != -1)
+        {
+            visitOven(sim, id, slot, VISIT_LOAD, now);
+            return;
+        }
+        ovenReleaseSlot(&sim->ovens.ovens[slot].oven);
+    }
+
+    releaseTools(sim, id, now);
+    cook->scan = 0;
+    cookRun(sim, id, now);
+}
+
+// One pass of the server's cook loop from the top
+static void cookRun(Simulation *sim, int id, long long now)
+{
+    SimCook *cook = &sim->cooks[id];
+    int index;
+    while ((index = takePrepWork(sim, id, now)) != -1)
+    {
+        sim->prepStarted++;
+        admitBlocked(sim, now);
+        SimOrder *order = &sim->orders[index];
+        if (sim->rules.policy == ADMIT_DEADLINE && now - order->admitted > sim->rules.deadlineMicros)
+        {
+            sim->expired++;
+            dropOrder(sim);
+            continue;
+        }
+        cook->state = COOK_BUSY;
+        cook->preparing = index;
+        schedule(&sim->queue, now + order->prepTime, EVENT_PREPARED, id);
+        return;
+    }
+
+    if (hasOvenWork(sim, now))
+    {
+        cook->state = COOK_BUSY;
+        cookNextVisit(sim, id, now);
+        return;
+    }
+    cook->state = COOK_IDLE;
+    sim->idle[sim->idleCount++] = id;
+}
+
+static void dispatchCouriers(Simulation *sim, long long now)
+{
+    while (sim->idleCouriers > 0)
+    {
+        int waiting = routeBoardCount(&sim->board);
+        if (waiting == 0 || (waiting < DELIVERY_ORDER_COUNT && sim->received - sim->pickedUp >= DELIVERY_ORDER_COUNT))
+        {
+            return;
+        }
+
+        RouteStop route[DELIVERY_ORDER_COUNT];
+        int stops = takeRouteBatch(&sim->board, route, DELIVERY_ORDER_COUNT);
+        planRoute(route, stops, 0, 0);
+        sim->pickedUp += stops;
+        sim->idleCouriers--;
+
+        long long time = now;
+        int atP = 0;
+        int atQ = 0;
+        for (int i = 0; i < stops; i++)
+        {
+            SimOrder *order = route[i].data;
+            time += travelTime(atP, atQ, order->p, order->q, sim->config.speed);
+            histogramRecord(&sim->latency, time - order->arrival);
+            sim->lastDelivery = time > sim->lastDelivery ? time : sim->lastDelivery;
+            sim->delivered++;
+            atP = order->p;
+            atQ = order->q;
+        }
+        schedule(&sim->queue, time + travelTime(atP, atQ, 0, 0, sim->config.speed), EVENT_COURIER_BACK, 0);
+    }
+}
+
+static void handleEvent(Simulation *sim, Event *event)
+{
+    long long now = event->time;
+    switch (event->type)
+    {
+    case EVENT_ARRIVAL:
+        arrive(sim, event->index, now);
+        break;
+    case EVENT_PREPARED:
+        // Like the server, a cook goes to the ovens after every preparation
+        simDequePush(&sim->cooks[event->index].ovenWork, sim->cooks[event->index].preparing);
+        sim->waitingPides++;
+        cookNextVisit(sim, event->index, now);
+        break;
+    case EVENT_BAKED:
+        // The idle cook watching the ovens, without one the pide waits for the next cook done preparing
+        wakeCook(sim, now);
+        break;
+    case EVENT_WAKE:
+        cookRun(sim, event->index, now);
+        break;
+    case EVENT_OVEN_DONE:
+        cookNextVisit(sim, event->index, now);
+        break;
+    case EVENT_COURIER_BACK:
+        sim->idleCouriers++;
+        break;
+    }
+    dispatchCouriers(sim, now);
+}
+
+// Returns the simulated seconds from the first arrival to the last delivery
+static double simulate(Simulation *sim, SimOrder *orders, int orderCount, SimConfig config, SimRules rules, OvenGroupSpec *ovenSpec)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->config = config;
+    sim->rules = rules;
+    sim->orders = orders;
+    sim->orderCount = orderCount;
+    sim->queue.capacity = orderCount + config.cooks + config.couriers;
+    sim->queue.events = allocOrDie(sim->queue.capacity * sizeof(Event));
+    sim->shared = allocOrDie(orderCount * sizeof(int));
+    sim->blocked = allocOrDie(orderCount * sizeof(int));
+    sim->cooks = allocOrDie(config.cooks * sizeof(SimCook));
+    sim->idle = allocOrDie(config.cooks * sizeof(int));
+    if (initOvenGroup(&sim->ovens, ovenSpec->specs, ovenSpec->count) == -1)
+    {
+        perror("initOvenGroup");
+        exit(1);
+    }
+    sim->tools = allocOrDie(ovenSpec->count * sizeof(OvenTools));
+    for (int i = 0; i < ovenSpec->count; i++)
+    {
+        OvenSpec *spec = &ovenSpec->specs[i];
+        sim->tools[i].free = spec->doors < spec->paddles ? spec->doors : spec->paddles;
+        sim->tools[i].waiters = allocOrDie(config.cooks * sizeof(int));
+        sim->tools[i].waitHead = 0;
+        sim->tools[i].waitTail = 0;
+    }
+    for (int i = 0; i < config.cooks; i++)
+    {
+        SimCook *cook = &sim->cooks[i];
+        initSimDeque(&cook->prepWork);
+        initSimDeque(&cook->ovenWork);
+        cook->state = COOK_IDLE;
+        cook->held = -1;
+        cook->scan = 0;
+        // Popped from the end, so cook 0 is woken first
+        sim->idle[i] = config.cooks - 1 - i;
+    }
+    sim->idleCount = config.cooks;
+    if (initRouteBoard(&sim->board, orderCount) == -1)
+    {
+        perror("initRouteBoard");
+        exit(1);
+    }
+    initHistogram(&sim->latency);
+    sim->idleCouriers = config.couriers;
+
+    for (int i = 0; i < orderCount; i++)
+    {
+        schedule(&sim->queue, orders[i].arrival, EVENT_ARRIVAL, i);
+    }
+    while (sim->queue.count > 0)
+    {
+        Event event = nextEvent(&sim->queue);
+        handleEvent(sim, &event);
+    }
+
+    for (int i = 0; i < config.cooks; i++)
+    {
+        free(sim->cooks[i].prepWork.items);
+        free(sim->cooks[i].ovenWork.items);
+    }
+    for (int i = 0; i < ovenSpec->count; i++)
+    {
+        free(sim->tools[i].waiters);
+    }
+    destroyOvenGroup(&sim->ovens);
+    destroyRouteBoard(&sim->board);
+    free(sim->tools);
+    free(sim->cooks);
+    free(sim->idle);
+    free(sim->queue.events);
+    free(sim->shared);
+    free(sim->blocked);
+    return sim->delivered > 0 ? (sim->lastDelivery - orders[0].arrival) / 1e6 : 0;
+}
+
+// Parses a comma separated list of positive integers, returns how many there were or -1
+static int parseSweep(const char *text, int *values)
+{
+    int count = 0;
+    const char *cursor = text;
+    while (*cursor != '\0' && count < MAX_SWEEP_VALUES)
+    {
+        char *end;
+        long value = strtol(cursor, &end, 10);
+        if (end == cursor || value < 1 || value > 1024 || (*end != ',' && *end != '\0'))
+        {
+            return -1;
+        }
+        values[count++] = (int)value;
+        cursor = *end == ',' ? end + 1 : end;
+    }
+    return *cursor == '\0' && count > 0 ? count : -1;
+}
+
+// Oven groups in the server's -O format separated by slashes, like 6:2:3/6:2:3,4:1:2
+static int parseOvenSweep(const char *text, OvenGroupSpec *groups)
+{
+    OvenSpec defaults = {OVEN_CAPACITY, OVEN_DOORS, OVEN_APARATUS};
+    int count = 0;
+    const char *cursor = text;
+    while (count < MAX_SWEEP_VALUES)
+    {
+        const char *end = strchr(cursor, '/');
+        size_t length = end == NULL ? strlen(cursor) : (size_t)(end - cursor);
+        OvenGroupSpec *group = &groups[count];
+        if (length == 0 || length >= sizeof(group->text))
+        {
+            return -1;
+        }
+        memcpy(group->text, cursor, length);
+        group->text[length] = '\0';
+        group->count = parseOvenSpecs(group->text, group->specs, MAX_OVENS, defaults);
+        if (group->count == -1)
+        {
+            return -1;
+        }
+        count++;
+        if (end == NULL)
+        {
+            return count;
+        }
+        cursor = end + 1;
+    }
+    return -1;
+}
+
+static void printUsage(char *program)
+{
+    fprintf(stderr, "Usage: %s [-n orders] [-r rate] [-P prepMicros] [-T toolMicros] [-a policy] [-Q maxQueued] [-W deadline] [-p p] [-q q] [-s seed] [cookPoolSize] [deliveryPoolSize] [ovens] [deliverySpeed]\n", program);
+    fprintf(stderr, "  pool arguments and the speed may be lists like 1,2,4, each combination is one CSV row\n");
+    fprintf(stderr, "  ovens         like -O of the server, groups to sweep are separated by / like 6:2:3/6:2:3,4:1:2\n");
+    fprintf(stderr, "  -n orders     orders to simulate (default %d)\n", DEFAULT_ORDERS);
+    fprintf(stderr, "  -r rate       orders per second with Poisson arrivals, 0 for all at once (default)\n");
+    fprintf(stderr, "  -P prepMicros mean preparation time, the oven takes half of it (default %d)\n", DEFAULT_PREPARE_MICROS);
+    fprintf(stderr, "  -T toolMicros a cook holds a door and a paddle this long per pide moved (default %d)\n", DEFAULT_TOOL_MICROS);
+    fprintf(stderr, "  -a, -Q, -W    admission policy, queue bound and deadline as in the server (default block)\n");
+    fprintf(stderr, "  -p, -q        town size (default %d)\n", DEFAULT_TOWN_SIZE);
+    fprintf(stderr, "  -s seed       seed for arrivals, positions and preparation times (default 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *policyNames[] = {"block", "reject", "deadline", "shed"};
+    int orderCount = DEFAULT_ORDERS;
+    double rate = 0;
+    int prepMicros = DEFAULT_PREPARE_MICROS;
+    int townP = DEFAULT_TOWN_SIZE;
+    int townQ = DEFAULT_TOWN_SIZE;
+    unsigned long long seed = 1;
+    SimRules rules = {ADMIT_BLOCK, 0, DEFAULT_QUEUE_DEADLINE * 1000, DEFAULT_TOOL_MICROS};
+    int option;
+    while ((option = getopt(argc, argv, "n:r:P:T:a:Q:W:p:q:s:")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            orderCount = atoi(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'P':
+            prepMicros = atoi(optarg);
+            break;
+        case 'T':
+            rules.toolMicros = atoi(optarg);
+            break;
+        case 'a':
+            rules.policy = -1;
+            for (int i = 0; i < 4; i++)
+            {
+                if (strcmp(optarg, policyNames[i]) == 0)
+                {
+                    rules.policy = i;
+                }
+            }
+            if (rules.policy == -1)
+            {
+                fprintf(stderr, "Policy must be one of block, reject, deadline, shed\n");
+                return 1;
+            }
+            break;
+        case 'Q':
+            rules.maxQueued = atoi(optarg);
+            break;
+        case 'W':
+            rules.deadlineMicros = atoi(optarg) * 1000;
+            break;
+        case 'p':
+            townP = atoi(optarg);
+            break;
+        case 'q':
+            townQ = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 4)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    int sweeps[4][MAX_SWEEP_VALUES];
+    int sweepSizes[4];
+    OvenGroupSpec ovenSweep[MAX_SWEEP_VALUES];
+    for (int i = 0; i < 4; i++)
+    {
+        sweepSizes[i] = i == 2 ? parseOvenSweep(argv[optind + i], ovenSweep) : parseSweep(argv[optind + i], sweeps[i]);
+        if (sweepSizes[i] == -1 && i == 2)
+        {
+            fprintf(stderr, "%s must be at most %d oven groups like 6:2:3,4:1:2 separated by /\n", argv[optind + i], MAX_SWEEP_VALUES);
+            return 1;
+        }
+        if (sweepSizes[i] == -1)
+        {
+            fprintf(stderr, "%s must be a list of at most %d values in range 1-1024\n", argv[optind + i], MAX_SWEEP_VALUES);
+            return 1;
+        }
+    }
+
+    if (orderCount < 1 || orderCount > 10000000 || rate < 0 || prepMicros < 1 || townP < 1 || townQ < 1 || rules.toolMicros < 0 || rules.maxQueued < 0 || rules.deadlineMicros < 0)
+    {
+        fprintf(stderr, "Orders must be in range 1-10000000, rate, toolMicros, maxQueued and deadline must not be negative, prepMicros and the town size must be positive\n");
+        return 1;
+    }
+    // Like ORDER_QUEUE_CAPACITY in the server, nothing is turned away unless -Q is given
+    if (rules.maxQueued == 0)
+    {
+        rules.maxQueued = orderCount;
+    }
+
+    // xorshift never leaves zero
+    rngState = seed * 2654435761ULL + 1;
+    SimOrder *orders = allocOrDie(orderCount * sizeof(SimOrder));
+    double arrival = 0;
+    for (int i = 0; i < orderCount; i++)
+    {
+        if (rate > 0)
+        {
+            arrival += -log(1.0 - nextRandom()) / rate * 1000000;
+        }
+        orders[i].arrival = (long long)arrival;
+        orders[i].p = (int)(nextRandom() * townP);
+        orders[i].q = (int)(nextRandom() * townQ);
+        orders[i].prepTime = (long long)(prepMicros * (0.5 + nextRandom()));
+    }
+
+    Simulation sim;
+    printf("cooks,couriers,ovens,speed,policy,orders,delivered,rejected,shed,expired,simulated_s,throughput,mean_ms,p50_ms,p99_ms,tool_wait_us,wall_ms\n");
+    for (int c = 0; c < sweepSizes[0]; c++)
+    {
+        for (int d = 0; d < sweepSizes[1]; d++)
+        {
+            for (int o = 0; o < sweepSizes[2]; o++)
+            {
+                for (int s = 0; s < sweepSizes[3]; s++)
+                {
+                    SimConfig config = {sweeps[0][c], sweeps[1][d], sweeps[3][s]};
+
+                    struct timespec begin, end;
+                    clock_gettime(CLOCK_MONOTONIC, &begin);
+                    double simulated = simulate(&sim, orders, orderCount, config, rules, &ovenSweep[o]);
+                    clock_gettime(CLOCK_MONOTONIC, &end);
+                    double wall = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+
+                    printf("%d,%d,\"%s\",%d,%s,%d,%d,%d,%d,%d,%.3f,%.1f,%.3f,%.3f,%.3f,%.1f,%.1f\n", config.cooks, config.couriers, ovenSweep[o].text, config.speed,
+                           policyNames[rules.policy], orderCount, sim.delivered, sim.rejected, sim.shed, sim.expired, simulated,
+                           simulated > 0 ? sim.delivered / simulated : 0.0, histogramMean(&sim.latency) / 1000, histogramPercentile(&sim.latency, 50) / 1000.0,
+                           histogramPercentile(&sim.latency, 99) / 1000.0, sim.toolVisits > 0 ? (double)sim.toolWaitMicros / sim.toolVisits : 0.0, wall);
+                }
+            }
+        }
+    }
+
+    free(orders);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "affinity.h"
+
+// Parses lists like "0-3,8,10-11", returns -1 on malformed input
+int parseCpuList(const char *text, CpuList *list)
+{
+    CPU_ZERO(&list->cpus);
+    list->count = 0;
+
+    const char *cursor = text;
+    while (*cursor != '\0')
+    {
+        char *end;
+        long first = strtol(cursor, &end, 10);
+        if (end == cursor || first < 0 || first >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+        long last = first;
+        cursor = end;
+        if (*cursor == '-')
+        {
+            cursor++;
+            last = strtol(cursor, &end, 10);
+            if (end == cursor || last < first || last >= CPU_SETSIZE)
+            {
+                return -1;
+            }
+            cursor = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            if (!CPU_ISSET(cpu, &list->cpus))
+            {
+                CPU_SET(cpu, &list->cpus);
+                list->count++;
+            }
+        }
+        if (*cursor == ',')
+        {
+            cursor++;
+        }
+        else if (*cursor != '\0')
+        {
+            return -1;
+        }
+    }
+    return list->count > 0 ? 0 : -1;
+}
+
+// Every CPU of the list has to be one the process may run on
+int cpuListAllowed(CpuList *list)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+    {
+        return 0;
+    }
+    cpu_set_t both;
+    CPU_AND(&both, &allowed, &list->cpus);
+    return CPU_EQUAL(&both, &list->cpus);
+}
+
+int cpuListNth(CpuList *list, int n)
+{
+    n %= list->count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &list->cpus) && n-- == 0)
+        {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+int onlineCpuCount()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count < 1 ? 1 : (int)count;
+}
+
+// Threads are created already pinned, so whatever they allocate first is touched on their node
+void setThreadCpu(pthread_attr_t *attr, CpuList *list, int n)
+{
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    CPU_SET(cpuListNth(list, n), &cpu);
+    pthread_attr_setaffinity_np(attr, sizeof(cpu), &cpu);
+}
@@ -0,0 +1,20 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <sched.h>
+#include <pthread.h>
+
+// CPUs a pool may run on, the n-th thread of the pool is pinned to the n-th CPU (wrapping)
+typedef struct
+{
+    cpu_set_t cpus;
+    int count;
+} CpuList;
+
+int parseCpuList(const char *text, CpuList *list);
+int cpuListAllowed(CpuList *list);
+int cpuListNth(CpuList *list, int n);
+int onlineCpuCount();
+void setThreadCpu(pthread_attr_t *attr, CpuList *list, int n);
+
+#endif /* AFFINITY_H */
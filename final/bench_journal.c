@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+
+#include "journal.h"
+
+#define RECORDS_PER_THREAD 500
+
+// Every thread journals an order and waits until it is durable before the
+// next one, the way the front end holds back an ACK. Group commit is
+// compared with a journal that writes and syncs each record under a lock.
+
+typedef struct
+{
+    int grouped;
+    int id;
+    Journal *journal;
+    int fd;
+    pthread_mutex_t *mutex;
+    atomic_int *start;
+} BenchArgs;
+
+void *benchThread(void *arg)
+{
+    BenchArgs *args = (BenchArgs *)arg;
+    while (!atomic_load(args->start))
+    {
+        sched_yield();
+    }
+
+    for (int i = 0; i < RECORDS_PER_THREAD; i++)
+    {
+        uint64_t id = (uint64_t)args->id * RECORDS_PER_THREAD + i + 1;
+        if (args->grouped)
+        {
+            long long sequence = journalAppend(args->journal, JOURNAL_RECEIVED, id, args->id, i, i);
+            while (journalDurable(args->journal) < sequence)
+            {
+                sched_yield();
+            }
+        }
+        else
+        {
+            JournalRecord record = {0};
+            record.type = JOURNAL_RECEIVED;
+            record.id = id;
+            pthread_mutex_lock(args->mutex);
+            write(args->fd, &record, sizeof(record));
+            fdatasync(args->fd);
+            pthread_mutex_unlock(args->mutex);
+        }
+    }
+    return NULL;
+}
+
+double runBench(const char *path, int grouped, int threadCount, double *perCommit)
+{
+    unlink(path);
+    Journal journal;
+    JournalRecord *live;
+    int liveCount;
+    uint64_t nextId;
+    int fd = -1;
+    pthread_mutex_t mutex;
+    pthread_mutex_init(&mutex, NULL);
+    if (grouped)
+    {
+        if (openJournal(&journal, path, -1, JOURNAL_COMPACT_SIZE, &live, &liveCount, &nextId) == -1)
+        {
+            perror("openJournal");
+            exit(1);
+        }
+        free(live);
+    }
+    else
+    {
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    }
+
+    atomic_int start;
+    atomic_init(&start, 0);
+
+    pthread_t *threads = malloc(threadCount * sizeof(pthread_t));
+    BenchArgs *args = malloc(threadCount * sizeof(BenchArgs));
+    for (int i = 0; i < threadCount; i++)
+    {
+        args[i] = (BenchArgs){grouped, i, &journal, fd, &mutex, &start};
+        pthread_create(&threads[i], NULL, benchThread, &args[i]);
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    atomic_store(&start, 1);
+    for (int i = 0; i < threadCount; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    *perCommit = 1;
+    if (grouped)
+    {
+        *perCommit = (double)journalDurable(&journal) / atomic_load(&journal.commits);
+        closeJournal(&journal);
+    }
+    else
+    {
+        close(fd);
+    }
+    free(threads);
+    free(args);
+    pthread_mutex_destroy(&mutex);
+    unlink(path);
+
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    return (double)RECORDS_PER_THREAD * threadCount / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "bench.journal";
+    int threadCounts[] = {1, 4, 16, 64};
+
+    printf("threads,sync_per_record_per_sec,group_commit_per_sec,records_per_commit\n");
+    for (int i = 0; i < (int)(sizeof(threadCounts) / sizeof(threadCounts[0])); i++)
+    {
+        double perCommit;
+        double single = runBench(path, 0, threadCounts[i], &perCommit);
+        double grouped = runBench(path, 1, threadCounts[i], &perCommit);
+        printf("%d,%.0f,%.0f,%.1f\n", threadCounts[i], single, grouped, perCommit);
+    }
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+
+#include "circularqueue.h"
+#include "ringqueue.h"
+
+#define OPERATIONS_PER_THREAD 200000
+#define RING_CAPACITY 65536
+
+// Each thread alternates enqueue and dequeue, so producers and consumers
+// contend on both ends of the same queue the way cooks and couriers do.
+
+typedef struct
+{
+    int kind;
+    CircularQueue *circularQueue;
+    RingQueue *ringQueue;
+    atomic_int *start;
+} BenchArgs;
+
+static int token = 1;
+
+void *benchThread(void *arg)
+{
+    BenchArgs *args = (BenchArgs *)arg;
+    while (!atomic_load(args->start))
+    {
+        sched_yield();
+    }
+
+    for (int i = 0; i < OPERATIONS_PER_THREAD; i++)
+    {
+        if (args->kind == 0)
+        {
+            enqueue(args->circularQueue, &token);
+            while (dequeue(args->circularQueue) == NULL)
+            {
+                sched_yield();
+            }
+        }
+        else
+        {
+            while (!ringEnqueue(args->ringQueue, &token))
+            {
+                sched_yield();
+            }
+            while (ringDequeue(args->ringQueue) == NULL)
+            {
+                sched_yield();
+            }
+        }
+    }
+    return NULL;
+}
+
+double runBench(int kind, int threadCount)
+{
+    CircularQueue circularQueue;
+    RingQueue ringQueue;
+    initCircularQueue(&circularQueue);
+    initRingQueue(&ringQueue, RING_CAPACITY);
+
+    atomic_int start;
+    atomic_init(&start, 0);
+
+    pthread_t *threads = malloc(threadCount * sizeof(pthread_t));
+    BenchArgs args = {kind, &circularQueue, &ringQueue, &start};
+    for (int i = 0; i < threadCount; i++)
+    {
+        pthread_create(&threads[i], NULL, benchThread, &args);
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    atomic_store(&start, 1);
+    for (int i = 0; i < threadCount; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    free(threads);
+    pthread_mutex_destroy(&circularQueue.mutex);
+    destroyRingQueue(&ringQueue);
+
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    return 2.0 * OPERATIONS_PER_THREAD * threadCount / seconds;
+}
+
+int main()
+{
+    int threadCounts[] = {1, 2, 4, 8, 16, 32, 64};
+
+    printf("threads,circularqueue_ops_per_sec,ringqueue_ops_per_sec\n");
+    for (int i = 0; i < (int)(sizeof(threadCounts) / sizeof(threadCounts[0])); i++)
+    {
+        double circular = runBench(0, threadCounts[i]);
+        double ring = runBench(1, threadCounts[i]);
+        printf("%d,%.0f,%.0f\n", threadCounts[i], circular, ring);
+    }
+
+    return 0;
+}
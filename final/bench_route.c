@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "route.h"
+
+#define ORDER_COUNT 20000
+#define ARRIVALS_PER_SECOND 8.0
+#define TOWN_SIZE 100
+#define DELIVERY_SPEED 1
+#define BATCH_SIZE 3
+
+// Couriers are simulated instead of slept, travel takes the same
+// legCost / (deliverySpeed * 10000) seconds the server sleeps for.
+// Orders become ready at Poisson arrival times at uniform positions.
+
+typedef struct
+{
+    double readyAt;
+    int p;
+    int q;
+} SimOrder;
+
+static unsigned long long rngState = 88172645463325252ULL;
+
+static double nextRandom()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return (rngState >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double travelTime(int fromP, int fromQ, int toP, int toQ)
+{
+    return legCost(fromP, fromQ, toP, toQ) / (DELIVERY_SPEED * 10000.0);
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the mean delivery time and stores the 99th percentile
+static double simulate(SimOrder *orders, int couriers, int routed, double *p99)
+{
+    double *freeAt = calloc(couriers, sizeof(double));
+    double *deliveryTimes = malloc(ORDER_COUNT * sizeof(double));
+    RouteBoard board;
+    initRouteBoard(&board, ORDER_COUNT);
+
+    int next = 0;
+    int delivered = 0;
+    while (delivered < ORDER_COUNT)
+    {
+        // The courier that gets back first takes the next batch
+        int courier = 0;
+        for (int i = 1; i < couriers; i++)
+        {
+            if (freeAt[i] < freeAt[courier])
+            {
+                courier = i;
+            }
+        }
+
+        double now = freeAt[courier];
+        while (next < ORDER_COUNT && orders[next].readyAt <= now)
+        {
+            routeBoardAdd(&board, orders[next].p, orders[next].q, &orders[next]);
+            next++;
+        }
+        while (next < ORDER_COUNT && routeBoardCount(&board) < BATCH_SIZE)
+        {
+            now = orders[next].readyAt;
+            routeBoardAdd(&board, orders[next].p, orders[next].q, &orders[next]);
+            next++;
+        }
+
+        RouteStop batch[BATCH_SIZE];
+        int stops;
+        if (routed)
+        {
+            stops = takeRouteBatch(&board, batch, BATCH_SIZE);
+            planRoute(batch, stops, 0, 0);
+        }
+        else
+        {
+            stops = board.count < BATCH_SIZE ? board.count : BATCH_SIZE;
+            for (int i = 0; i < stops; i++)
+            {
+                batch[i] = board.stops[i];
+            }
+            for (int i = stops; i < board.count; i++)
+            {
+                board.stops[i - stops] = board.stops[i];
+            }
+            board.count -= stops;
+        }
+
+        int atP = 0;
+        int atQ = 0;
+        for (int i = 0; i < stops; i++)
+        {
+            SimOrder *order = batch[i].data;
+            now += travelTime(atP, atQ, order->p, order->q);
+            deliveryTimes[delivered++] = now - order->readyAt;
+            atP = order->p;
+            atQ = order->q;
+        }
+        freeAt[courier] = now + travelTime(atP, atQ, 0, 0);
+    }
+
+    double sum = 0;
+    for (int i = 0; i < ORDER_COUNT; i++)
+    {
+        sum += deliveryTimes[i];
+    }
+    qsort(deliveryTimes, ORDER_COUNT, sizeof(double), compareDoubles);
+    *p99 = deliveryTimes[(int)(ORDER_COUNT * 0.99)];
+
+    destroyRouteBoard(&board);
+    free(deliveryTimes);
+    free(freeAt);
+    return sum / ORDER_COUNT;
+}
+
+int main()
+{
+    SimOrder *orders = malloc(ORDER_COUNT * sizeof(SimOrder));
+    double time = 0;
+    for (int i = 0; i < ORDER_COUNT; i++)
+    {
+        time += -log(1.0 - nextRandom()) / ARRIVALS_PER_SECOND;
+        orders[i].readyAt = time;
+        orders[i].p = (int)(nextRandom() * TOWN_SIZE);
+        orders[i].q = (int)(nextRandom() * TOWN_SIZE);
+    }
+
+    printf("%d orders, %.1f orders/s, %dx%d town, speed %d\n", ORDER_COUNT, ARRIVALS_PER_SECOND, TOWN_SIZE, TOWN_SIZE, DELIVERY_SPEED);
+    printf("%10s %12s %12s %12s %12s\n", "couriers", "fifo mean", "fifo p99", "routed mean", "routed p99");
+    int poolSizes[] = {1, 2, 4, 6, 8, 16};
+    for (int i = 0; i < (int)(sizeof(poolSizes) / sizeof(poolSizes[0])); i++)
+    {
+        double fifoP99, routedP99;
+        double fifoMean = simulate(orders, poolSizes[i], 0, &fifoP99);
+        double routedMean = simulate(orders, poolSizes[i], 1, &routedP99);
+        printf("%10d %11.2fs %11.2fs %11.2fs %11.2fs\n", poolSizes[i], fifoMean, fifoP99, routedMean, routedP99);
+    }
+
+    free(orders);
+    return 0;
+}
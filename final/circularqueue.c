@@ -8,6 +8,7 @@ void initCircularQueue(CircularQueue *queue)
 {
     queue->current = NULL;
     queue->size = 0;
+    queue->spareNodes = NULL;
     pthread_mutex_init(&queue->mutex, NULL);
 }
 
@@ -45,7 +46,15 @@ void next(CircularQueue *queue)
 void enqueue(CircularQueue *queue, void *data)
 {
     pthread_mutex_lock(&queue->mutex);
-    Node *newNode = (Node *)malloc(sizeof(Node));
+    Node *newNode = queue->spareNodes;
+    if (newNode != NULL)
+    {
+        queue->spareNodes = newNode->next;
+    }
+    else
+    {
+        newNode = (Node *)malloc(sizeof(Node));
+    }
     if (newNode == NULL)
     {
         pthread_mutex_unlock(&queue->mutex);
@@ -88,8 +97,11 @@ void *dequeue(CircularQueue *queue)
     }
 
     queue->size--;
+
+    // Dequeued nodes are kept for the next enqueue instead of being freed
+    node->next = queue->spareNodes;
+    queue->spareNodes = node;
     pthread_mutex_unlock(&queue->mutex);
-    free(node);
     return data;
 }
 
@@ -105,5 +117,11 @@ void clearCircularQueue(CircularQueue *queue)
         queue->size--;
     }
     queue->current = NULL;
+    while (queue->spareNodes != NULL)
+    {
+        Node *node = queue->spareNodes;
+        queue->spareNodes = node->next;
+        free(node);
+    }
     pthread_mutex_unlock(&queue->mutex);
 }
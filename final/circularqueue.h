@@ -13,6 +13,7 @@ typedef struct
 {
     Node *current;
     int size;
+    Node *spareNodes;
     pthread_mutex_t mutex;
 } CircularQueue;
 
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "deque.h"
+
+// Follows "Correct and Efficient Work-Stealing for Weak Memory Models"
+// (Le, Pop, Cohen, Zappa Nardelli), the owner only synchronises with
+// thieves when it takes the last element.
+
+static DequeArray *createDequeArray(size_t size)
+{
+    DequeArray *array = malloc(sizeof(DequeArray) + size * sizeof(array->slots[0]));
+    if (array == NULL)
+    {
+        return NULL;
+    }
+    array->mask = size - 1;
+    array->retired = NULL;
+    return array;
+}
+
+int initWorkDeque(WorkDeque *deque, size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    DequeArray *array = createDequeArray(size);
+    if (array == NULL)
+    {
+        return -1;
+    }
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->array, array);
+    return 0;
+}
+
+void destroyWorkDeque(WorkDeque *deque)
+{
+    DequeArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    while (array != NULL)
+    {
+        DequeArray *retired = array->retired;
+        free(array);
+        array = retired;
+    }
+    atomic_store_explicit(&deque->array, NULL, memory_order_relaxed);
+}
+
+// Owner only, returns 0 if a larger array could not be allocated
+int dequePush(WorkDeque *deque, void *data)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    DequeArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+
+    if (bottom - top > (long)array->mask)
+    {
+        DequeArray *grown = createDequeArray((array->mask + 1) * 2);
+        if (grown == NULL)
+        {
+            return 0;
+        }
+        for (long i = top; i < bottom; i++)
+        {
+            atomic_store_explicit(&grown->slots[i & grown->mask], atomic_load_explicit(&array->slots[i & array->mask], memory_order_relaxed), memory_order_relaxed);
+        }
+        grown->retired = array;
+        atomic_store_explicit(&deque->array, grown, memory_order_release);
+        array = grown;
+    }
+
+    atomic_store_explicit(&array->slots[bottom & array->mask], data, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return 1;
+}
+
+// Owner only, takes the most recently pushed element, NULL when empty
+void *dequePop(WorkDeque *deque)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    DequeArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    void *data = atomic_load_explicit(&array->slots[bottom & array->mask], memory_order_relaxed);
+    if (top == bottom)
+    {
+        // Last element, race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        {
+            data = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return data;
+}
+
+// Any thread, takes the oldest element. NULL when empty or when another
+// thread won the race for it, callers just move on to the next deque.
+void *dequeSteal(WorkDeque *deque)
+{
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom)
+    {
+        return NULL;
+    }
+
+    DequeArray *array = atomic_load_explicit(&deque->array, memory_order_acquire);
+    void *data = atomic_load_explicit(&array->slots[top & array->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+    {
+        return NULL;
+    }
+    return data;
+}
+
+int dequeIsEmpty(WorkDeque *deque)
+{
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    return bottom <= top;
+}
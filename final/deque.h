@@ -0,0 +1,33 @@
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "ringqueue.h"
+
+typedef struct DequeArray
+{
+    size_t mask;
+    struct DequeArray *retired;
+    _Atomic(void *) slots[];
+} DequeArray;
+
+// Chase-Lev work-stealing deque: only the owner pushes and pops at the bottom,
+// any thread may steal from the top. Full arrays are replaced by twice larger
+// ones, the old ones are kept until destroyWorkDeque since thieves may still read them.
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) atomic_long top;
+    _Alignas(CACHE_LINE_SIZE) atomic_long bottom;
+    _Atomic(DequeArray *) array;
+} WorkDeque;
+
+int initWorkDeque(WorkDeque *deque, size_t capacity);
+void destroyWorkDeque(WorkDeque *deque);
+int dequePush(WorkDeque *deque, void *data);
+void *dequePop(WorkDeque *deque);
+void *dequeSteal(WorkDeque *deque);
+int dequeIsEmpty(WorkDeque *deque);
+
+#endif /* DEQUE_H */
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "histogram.h"
+
+static int bucketIndex(long long value)
+{
+    if (value < 0)
+    {
+        value = 0;
+    }
+    if (value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return (int)value;
+    }
+
+    int shift = 63 - __builtin_clzll((unsigned long long)value) - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+    if (shift > HISTOGRAM_MAX_SHIFT)
+    {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    long long mantissa = value >> shift;
+    return HISTOGRAM_SUB_BUCKETS + (shift - 1) * HISTOGRAM_HALF_BUCKETS + (int)(mantissa - HISTOGRAM_HALF_BUCKETS);
+}
+
+// Largest value that lands in the bucket
+static long long bucketHighestValue(int index)
+{
+    if (index < HISTOGRAM_SUB_BUCKETS)
+    {
+        return index;
+    }
+    int shift = (index - HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_HALF_BUCKETS + 1;
+    long long mantissa = (index - HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_HALF_BUCKETS + HISTOGRAM_HALF_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void initHistogram(Histogram *histogram)
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        atomic_init(&histogram->counts[i], 0);
+    }
+    atomic_init(&histogram->total, 0);
+    atomic_init(&histogram->sum, 0);
+    atomic_init(&histogram->max, 0);
+}
+
+void histogramRecord(Histogram *histogram, long long value)
+{
+    atomic_fetch_add_explicit(&histogram->counts[bucketIndex(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+
+    long long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value, memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+long histogramCount(Histogram *histogram)
+{
+    return atomic_load_explicit(&histogram->total, memory_order_relaxed);
+}
+
+double histogramMean(Histogram *histogram)
+{
+    long total = histogramCount(histogram);
+    return total == 0 ? 0 : (double)atomic_load_explicit(&histogram->sum, memory_order_relaxed) / total;
+}
+
+long long histogramMax(Histogram *histogram)
+{
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
+
+// percentile is in 0-100, the result is capped by the largest recorded value
+long long histogramPercentile(Histogram *histogram, double percentile)
+{
+    long total = histogramCount(histogram);
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    long target = (long)ceil(percentile / 100.0 * total);
+    if (target < 1)
+    {
+        target = 1;
+    }
+
+    long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (seen >= target)
+        {
+            long long value = bucketHighestValue(i);
+            long long max = histogramMax(histogram);
+            return value < max ? value : max;
+        }
+    }
+    return histogramMax(histogram);
+}
@@ -0,0 +1,30 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdatomic.h>
+
+// Values below HISTOGRAM_SUB_BUCKETS are exact, larger ones keep their top
+// HISTOGRAM_SUB_BUCKET_BITS - 1 bits, so every value is within 1% of its bucket
+#define HISTOGRAM_SUB_BUCKET_BITS 8
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_HALF_BUCKETS (HISTOGRAM_SUB_BUCKETS / 2)
+#define HISTOGRAM_MAX_SHIFT 40
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS + HISTOGRAM_MAX_SHIFT * HISTOGRAM_HALF_BUCKETS)
+
+// Log-linear histogram in the style of HdrHistogram, recording is lock-free
+typedef struct
+{
+    atomic_long counts[HISTOGRAM_BUCKETS];
+    atomic_long total;
+    atomic_llong sum;
+    atomic_llong max;
+} Histogram;
+
+void initHistogram(Histogram *histogram);
+void histogramRecord(Histogram *histogram, long long value);
+long histogramCount(Histogram *histogram);
+double histogramMean(Histogram *histogram);
+long long histogramMax(Histogram *histogram);
+long long histogramPercentile(Histogram *histogram, double percentile);
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stddef.h>
+
+#include "journal.h"
+
+#define JOURNAL_READ_RECORDS 4096
+
+// A failed batch is retried with a doubling pause, after the last attempt the process stops
+#define JOURNAL_WRITE_ATTEMPTS 5
+#define JOURNAL_RETRY_MICROS 10000
+
+// FNV-1a over everything after the checksum field
+static uint32_t recordChecksum(const JournalRecord *record)
+{
+    const unsigned char *bytes = (const unsigned char *)record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = offsetof(JournalRecord, type); i < sizeof(JournalRecord); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int isValidRecord(const JournalRecord *record)
+{
+    return record->type >= JOURNAL_RECEIVED && record->type <= JOURNAL_FINISHED && record->checksum == recordChecksum(record);
+}
+
+static int writeRecords(int fd, const JournalRecord *records, int count)
+{
+    const char *data = (const char *)records;
+    size_t left = (size_t)count * sizeof(JournalRecord);
+    while (left > 0)
+    {
+        ssize_t written = write(fd, data, left);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        left -= written;
+    }
+    return 0;
+}
+
+static int compareRecords(const void *a, const void *b)
+{
+    const JournalRecord *left = a;
+    const JournalRecord *right = b;
+    if (left->id != right->id)
+    {
+        return left->id < right->id ? -1 : 1;
+    }
+    return left->type - right->type;
+}
+
+// Reads records up to the first torn or corrupt one and keeps the latest state
+// of every order without a JOURNAL_FINISHED record, ordered by id
+static int replayJournal(const char *path, JournalRecord **live, int *liveCount, uint64_t *nextId)
+{
+    *live = NULL;
+    *liveCount = 0;
+    *nextId = 1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    JournalRecord *records = NULL;
+    int count = 0;
+    int capacity = 0;
+    int torn = 0;
+    while (!torn)
+    {
+        if (count + JOURNAL_READ_RECORDS > capacity)
+        {
+            capacity = capacity == 0 ? JOURNAL_READ_RECORDS : capacity * 2;
+            JournalRecord *grown = realloc(records, (size_t)capacity * sizeof(JournalRecord));
+            if (grown == NULL)
+            {
+                free(records);
+                close(fd);
+                return -1;
+            }
+            records = grown;
+        }
+
+        ssize_t bytesRead = read(fd, records + count, JOURNAL_READ_RECORDS * sizeof(JournalRecord));
+        if (bytesRead == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            break;
+        }
+
+        // A partial record can only be the tail of a write cut short by a crash
+        int complete = bytesRead / sizeof(JournalRecord);
+        torn = bytesRead % sizeof(JournalRecord) != 0;
+        for (int i = 0; i < complete; i++)
+        {
+            if (!isValidRecord(&records[count]))
+            {
+                torn = 1;
+                break;
+            }
+            count++;
+        }
+    }
+    close(fd);
+
+    qsort(records, count, sizeof(JournalRecord), compareRecords);
+
+    int kept = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (records[i].id >= *nextId)
+        {
+            *nextId = records[i].id + 1;
+        }
+        // The last record of an id has its latest state
+        if ((i + 1 == count || records[i + 1].id != records[i].id) && records[i].type != JOURNAL_FINISHED)
+        {
+            records[kept++] = records[i];
+        }
+    }
+
+    *live = records;
+    *liveCount = kept;
+    return 0;
+}
+
+// Writes the live records to a new file and renames it over the journal, so a
+// crash at any point leaves either the old or the new journal complete
+static int rewriteJournal(const char *path, const JournalRecord *live, int liveCount)
+{
+    char temporary[PATH_MAX];
+    snprintf(temporary, sizeof(temporary), "%s.compact", path);
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (writeRecords(fd, live, liveCount) == -1 || fdatasync(fd) == -1)
+    {
+        close(fd);
+        unlink(temporary);
+        return -1;
+    }
+    close(fd);
+
+    if (rename(temporary, path) == -1)
+    {
+        unlink(temporary);
+        return -1;
+    }
+
+    // The rename itself is only durable once the directory is synced
+    char directory[PATH_MAX];
+    snprintf(directory, sizeof(directory), "%s", path);
+    int directoryFd = open(dirname(directory), O_RDONLY | O_DIRECTORY);
+    if (directoryFd != -1)
+    {
+        fsync(directoryFd);
+        close(directoryFd);
+    }
+    return 0;
+}
+
+static int compactJournal(Journal *journal, JournalRecord **live, int *liveCount, uint64_t *nextId)
+{
+    if (replayJournal(journal->path, live, liveCount, nextId) == -1 || rewriteJournal(journal->path, *live, *liveCount) == -1)
+    {
+        return -1;
+    }
+
+    int fd = open(journal->path, O_WRONLY | O_APPEND);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (journal->fd != -1)
+    {
+        close(journal->fd);
+    }
+    journal->fd = fd;
+    journal->size = (off_t)*liveCount * sizeof(JournalRecord);
+    journal->compactAt = journal->size * 2 > journal->compactSize ? journal->size * 2 : journal->compactSize;
+    return 0;
+}
+
+static void *writer(void *arg)
+{
+    Journal *journal = arg;
+
+    pthread_mutex_lock(&journal->mutex);
+    while (journal->running || journal->pendingCount > 0)
+    {
+        if (journal->pendingCount == 0)
+        {
+            pthread_cond_wait(&journal->cond, &journal->mutex);
+            continue;
+        }
+
+        // Swap buffers so appends continue while this batch is written and synced
+        JournalRecord *batch = journal->pending;
+        int batchCount = journal->pendingCount;
+        int batchCapacity = journal->pendingCapacity;
+        long long batchEnd = journal->appended;
+        journal->pending = journal->writing;
+        journal->pendingCapacity = journal->writingCapacity;
+        journal->pendingCount = 0;
+        journal->writing = batch;
+        journal->writingCapacity = batchCapacity;
+        pthread_mutex_unlock(&journal->mutex);
+
+        // Nothing in the batch counts as durable until all of it is written and synced
+        int attempt = 0;
+        while (writeRecords(journal->fd, batch, batchCount) == -1 || fdatasync(journal->fd) == -1)
+        {
+            perror("Could not write the journal");
+            // Cut off what part of the batch got in, the retry appends all of it again
+            if (ftruncate(journal->fd, journal->size) == -1 || ++attempt == JOURNAL_WRITE_ATTEMPTS)
+            {
+                fprintf(stderr, "Giving up on the journal, orders can no longer be made durable\n");
+                exit(EXIT_FAILURE);
+            }
+            usleep(JOURNAL_RETRY_MICROS << attempt);
+        }
+        journal->size += (off_t)batchCount * sizeof(JournalRecord);
+        atomic_store_explicit(&journal->durable, batchEnd, memory_order_release);
+        atomic_fetch_add(&journal->commits, 1);
+        if (journal->notifyFd != -1)
+        {
+            uint64_t one = 1;
+            write(journal->notifyFd, &one, sizeof(one));
+        }
+
+        // Only this thread writes the file, so it can be compacted between batches
+        if (journal->size >= journal->compactAt)
+        {
+            JournalRecord *live;
+            int liveCount;
+            uint64_t nextId;
+            if (compactJournal(journal, &live, &liveCount, &nextId) == -1)
+            {
+                perror("Could not compact the journal");
+            }
+            else
+            {
+                atomic_fetch_add(&journal->compactions, 1);
+            }
+            free(live);
+        }
+
+        pthread_mutex_lock(&journal->mutex);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    return NULL;
+}
+
+// Replays the journal at path and compacts it down to the orders that were
+// still live, they are returned to be put back in the queues. The caller frees live.
+int openJournal(Journal *journal, const char *path, int notifyFd, off_t compactSize, JournalRecord **live, int *liveCount, uint64_t *nextId)
+{
+    journal->fd = -1;
+    journal->running = 0;
+    journal->path = strdup(path);
+    journal->notifyFd = notifyFd;
+    journal->compactSize = compactSize;
+    journal->pendingCount = 0;
+    journal->pendingCapacity = JOURNAL_BATCH_RECORDS;
+    journal->writingCapacity = JOURNAL_BATCH_RECORDS;
+    journal->pending = malloc(JOURNAL_BATCH_RECORDS * sizeof(JournalRecord));
+    journal->writing = malloc(JOURNAL_BATCH_RECORDS * sizeof(JournalRecord));
+    journal->appended = 0;
+    atomic_init(&journal->durable, 0);
+    atomic_init(&journal->commits, 0);
+    atomic_init(&journal->compactions, 0);
+    *live = NULL;
+    if (journal->path == NULL || journal->pending == NULL || journal->writing == NULL ||
+        compactJournal(journal, live, liveCount, nextId) == -1)
+    {
+        closeJournal(journal);
+        free(*live);
+        *live = NULL;
+        return -1;
+    }
+
+    pthread_mutex_init(&journal->mutex, NULL);
+    pthread_cond_init(&journal->cond, NULL);
+    journal->running = 1;
+    if (pthread_create(&journal->writer, NULL, writer, journal) != 0)
+    {
+        journal->running = 0;
+        pthread_mutex_destroy(&journal->mutex);
+        pthread_cond_destroy(&journal->cond);
+        closeJournal(journal);
+        free(*live);
+        *live = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Commits everything appended so far before closing
+void closeJournal(Journal *journal)
+{
+    if (journal->running)
+    {
+        pthread_mutex_lock(&journal->mutex);
+        journal->running = 0;
+        pthread_cond_signal(&journal->cond);
+        pthread_mutex_unlock(&journal->mutex);
+        pthread_join(journal->writer, NULL);
+        pthread_mutex_destroy(&journal->mutex);
+        pthread_cond_destroy(&journal->cond);
+    }
+    if (journal->fd != -1)
+    {
+        close(journal->fd);
+        journal->fd = -1;
+    }
+    free(journal->pending);
+    free(journal->writing);
+    free(journal->path);
+    journal->pending = NULL;
+    journal->writing = NULL;
+    journal->path = NULL;
+}
+
+// Returns the sequence number of the record, it is durable once journalDurable
+// reaches it, or -1 if the record could not be buffered and will never be
+long long journalAppend(Journal *journal, int type, uint64_t id, int customerId, int p, int q)
+{
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = type;
+    record.id = id;
+    record.customerId = customerId;
+    record.p = p;
+    record.q = q;
+    record.checksum = recordChecksum(&record);
+
+    pthread_mutex_lock(&journal->mutex);
+    if (journal->pendingCount == journal->pendingCapacity)
+    {
+        JournalRecord *grown = realloc(journal->pending, (size_t)journal->pendingCapacity * 2 * sizeof(JournalRecord));
+        if (grown == NULL)
+        {
+            pthread_mutex_unlock(&journal->mutex);
+            perror("Could not grow the journal buffer");
+            return -1;
+        }
+        journal->pending = grown;
+        journal->pendingCapacity *= 2;
+    }
+    journal->pending[journal->pendingCount++] = record;
+    long long sequence = ++journal->appended;
+    if (journal->pendingCount == 1)
+    {
+        pthread_cond_signal(&journal->cond);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    return sequence;
+}
+
+long long journalDurable(Journal *journal)
+{
+    return atomic_load_explicit(&journal->durable, memory_order_acquire);
+}
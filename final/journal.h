@@ -0,0 +1,60 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Order state transitions, an order is live until its JOURNAL_FINISHED record
+#define JOURNAL_RECEIVED 1
+#define JOURNAL_COOKED 2
+#define JOURNAL_FINISHED 3
+
+#define JOURNAL_BATCH_RECORDS 1024
+#define JOURNAL_COMPACT_SIZE (64 * 1024 * 1024)
+
+// Fixed size so a torn tail is easy to cut off, the checksum covers the rest of the record
+typedef struct
+{
+    uint32_t checksum;
+    uint16_t type;
+    uint16_t reserved;
+    uint64_t id;
+    int32_t customerId;
+    int32_t p;
+    int32_t q;
+    int32_t padding;
+} JournalRecord;
+
+// Appends go to a buffer, one writer thread writes and syncs everything
+// appended while the previous sync ran as a single group commit
+typedef struct
+{
+    int fd;
+    char *path;
+    int notifyFd; // written after every commit, -1 for none
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    JournalRecord *pending;
+    int pendingCount;
+    int pendingCapacity;
+    JournalRecord *writing;
+    int writingCapacity;
+    long long appended;
+    atomic_llong durable;
+    atomic_llong commits;
+    atomic_llong compactions;
+    off_t size;
+    off_t compactSize;
+    off_t compactAt; // at least twice the live records, so a large live set is not rewritten every commit
+    int running;
+    pthread_t writer;
+} Journal;
+
+int openJournal(Journal *journal, const char *path, int notifyFd, off_t compactSize, JournalRecord **live, int *liveCount, uint64_t *nextId);
+void closeJournal(Journal *journal);
+long long journalAppend(Journal *journal, int type, uint64_t id, int customerId, int p, int q);
+long long journalDurable(Journal *journal);
+
+#endif /* JOURNAL_H */
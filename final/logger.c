@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#include "logger.h"
+
+#define LOG_BATCH_LINES 512
+
+typedef struct
+{
+    unsigned long sequence;
+    time_t time;
+    int length;
+    char text[LOG_LINE_SIZE];
+} LogRecord;
+
+// Written by one thread, drained by the writer thread
+typedef struct
+{
+    _Alignas(64) atomic_ulong head;
+    _Alignas(64) atomic_ulong tail;
+    LogRecord records[LOG_RING_LINES];
+} LogRing;
+
+static _Atomic(LogRing *) rings[LOG_MAX_THREADS];
+static atomic_int ringCount;
+static atomic_ulong nextSequence;
+static __thread LogRing *threadRing;
+
+static int logFile = -1;
+static int verbosity = LOG_DEBUG;
+static atomic_int running;
+static pthread_t writerThread;
+static pthread_mutex_t writerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writerCond = PTHREAD_COND_INITIALIZER;
+
+static LogRing *getThreadRing()
+{
+    if (threadRing != NULL)
+    {
+        return threadRing;
+    }
+
+    int index = atomic_fetch_add(&ringCount, 1);
+    if (index >= LOG_MAX_THREADS)
+    {
+        atomic_fetch_sub(&ringCount, 1);
+        return NULL;
+    }
+
+    LogRing *ring = calloc(1, sizeof(LogRing));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    atomic_store_explicit(&rings[index], ring, memory_order_release);
+    threadRing = ring;
+    return ring;
+}
+
+static void wakeWriter()
+{
+    pthread_mutex_lock(&writerMutex);
+    pthread_cond_signal(&writerCond);
+    pthread_mutex_unlock(&writerMutex);
+}
+
+void logMessage(int level, const char *format, ...)
+{
+    if (level > verbosity)
+    {
+        return;
+    }
+
+    LogRing *ring = atomic_load(&running) ? getThreadRing() : NULL;
+    if (ring == NULL)
+    {
+        // Without a writer thread or a ring the line is written directly
+        char text[LOG_LINE_SIZE];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+
+        char stamp[32];
+        time_t now = time(NULL);
+        struct tm tm_info;
+        localtime_r(&now, &tm_info);
+        strftime(stamp, sizeof(stamp), "[%Y-%m-%d %H:%M:%S] ", &tm_info);
+        printf("%s", text);
+        fflush(stdout);
+        if (logFile != -1)
+        {
+            dprintf(logFile, "%s%s", stamp, text);
+        }
+        return;
+    }
+
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LOG_RING_LINES)
+    {
+        // Memory is bounded, so a full ring waits for the writer instead of growing
+        wakeWriter();
+        sched_yield();
+    }
+
+    LogRecord *record = &ring->records[tail % LOG_RING_LINES];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(record->text, LOG_LINE_SIZE, format, args);
+    va_end(args);
+    if (length >= LOG_LINE_SIZE)
+    {
+        length = LOG_LINE_SIZE - 1;
+        record->text[length - 1] = '\n';
+    }
+    record->length = length < 0 ? 0 : length;
+    record->time = time(NULL);
+    record->sequence = atomic_fetch_add_explicit(&nextSequence, 1, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    if (tail + 1 - atomic_load_explicit(&ring->head, memory_order_relaxed) >= LOG_RING_LINES / 2)
+    {
+        wakeWriter();
+    }
+}
+
+static void writeAll(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+// Writes at most one batch, lines from different threads are merged by sequence number
+static int writeBatch()
+{
+    static LogRing *pending[LOG_MAX_THREADS];
+    static unsigned long heads[LOG_MAX_THREADS];
+    static unsigned long tails[LOG_MAX_THREADS];
+    static char stamps[LOG_BATCH_LINES][32];
+    static time_t stampTimes[LOG_BATCH_LINES];
+    struct iovec fileLines[2 * LOG_BATCH_LINES];
+    struct iovec consoleLines[LOG_BATCH_LINES];
+
+    int pendingCount = 0;
+    int count = atomic_load(&ringCount);
+    for (int i = 0; i < count && i < LOG_MAX_THREADS; i++)
+    {
+        LogRing *ring = atomic_load_explicit(&rings[i], memory_order_acquire);
+        if (ring == NULL)
+        {
+            continue;
+        }
+        unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head != tail)
+        {
+            pending[pendingCount] = ring;
+            heads[pendingCount] = head;
+            tails[pendingCount] = tail;
+            pendingCount++;
+        }
+    }
+
+    int lines = 0;
+    int stampCount = 0;
+    while (lines < LOG_BATCH_LINES)
+    {
+        int oldest = -1;
+        for (int i = 0; i < pendingCount; i++)
+        {
+            if (heads[i] != tails[i] &&
+                (oldest == -1 || pending[i]->records[heads[i] % LOG_RING_LINES].sequence < pending[oldest]->records[heads[oldest] % LOG_RING_LINES].sequence))
+            {
+                oldest = i;
+            }
+        }
+        if (oldest == -1)
+        {
+            break;
+        }
+
+        LogRecord *record = &pending[oldest]->records[heads[oldest] % LOG_RING_LINES];
+        heads[oldest]++;
+
+        // Timestamps are formatted once per second by this thread only
+        if (stampCount == 0 || stampTimes[stampCount - 1] != record->time)
+        {
+            struct tm tm_info;
+            localtime_r(&record->time, &tm_info);
+            strftime(stamps[stampCount], sizeof(stamps[stampCount]), "[%Y-%m-%d %H:%M:%S] ", &tm_info);
+            stampTimes[stampCount] = record->time;
+            stampCount++;
+        }
+
+        fileLines[2 * lines].iov_base = stamps[stampCount - 1];
+        fileLines[2 * lines].iov_len = strlen(stamps[stampCount - 1]);
+        fileLines[2 * lines + 1].iov_base = record->text;
+        fileLines[2 * lines + 1].iov_len = record->length;
+        consoleLines[lines].iov_base = record->text;
+        consoleLines[lines].iov_len = record->length;
+        lines++;
+    }
+
+    if (lines == 0)
+    {
+        return 0;
+    }
+
+    writeAll(STDOUT_FILENO, consoleLines, lines);
+    writeAll(logFile, fileLines, 2 * lines);
+
+    for (int i = 0; i < pendingCount; i++)
+    {
+        atomic_store_explicit(&pending[i]->head, heads[i], memory_order_release);
+    }
+    return lines;
+}
+
+static void *writer(void *arg)
+{
+    while (atomic_load(&running))
+    {
+        if (writeBatch() > 0)
+        {
+            continue;
+        }
+
+        struct timespec wakeTime;
+        clock_gettime(CLOCK_REALTIME, &wakeTime);
+        wakeTime.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000L;
+        if (wakeTime.tv_nsec >= 1000000000L)
+        {
+            wakeTime.tv_sec++;
+            wakeTime.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&writerMutex);
+        pthread_cond_timedwait(&writerCond, &writerMutex, &wakeTime);
+        pthread_mutex_unlock(&writerMutex);
+    }
+
+    while (writeBatch() > 0)
+    {
+    }
+    return NULL;
+}
+
+int initLogger(int logFd, int level)
+{
+    logFile = logFd;
+    verbosity = level;
+    atomic_store(&running, 1);
+    if (pthread_create(&writerThread, NULL, writer, NULL) != 0)
+    {
+        atomic_store(&running, 0);
+        return -1;
+    }
+    return 0;
+}
+
+// Writes out everything logged so far, later messages go straight to stdout
+void stopLogger()
+{
+    if (!atomic_load(&running))
+    {
+        return;
+    }
+    atomic_store(&running, 0);
+    wakeWriter();
+    pthread_join(writerThread, NULL);
+
+    int count = atomic_load(&ringCount);
+    for (int i = 0; i < count && i < LOG_MAX_THREADS; i++)
+    {
+        free(atomic_load(&rings[i]));
+        atomic_store(&rings[i], NULL);
+    }
+    atomic_store(&ringCount, 0);
+}
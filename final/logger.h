@@ -0,0 +1,17 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#define LOG_ERROR 0
+#define LOG_INFO 1
+#define LOG_DEBUG 2
+
+#define LOG_LINE_SIZE 232
+#define LOG_RING_LINES 256
+#define LOG_MAX_THREADS 2100
+#define LOG_FLUSH_INTERVAL_MS 100
+
+int initLogger(int logFd, int level);
+void stopLogger();
+void logMessage(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif /* LOGGER_H */
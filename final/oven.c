@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "oven.h"
+
+static void swapEntries(OvenEntry *a, OvenEntry *b)
+{
+    OvenEntry temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+static void siftUp(Oven *oven, int index)
+{
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+        if (oven->entries[parent].deadline <= oven->entries[index].deadline)
+        {
+            break;
+        }
+        swapEntries(&oven->entries[parent], &oven->entries[index]);
+        index = parent;
+    }
+}
+
+static void siftDown(Oven *oven, int index)
+{
+    while (1)
+    {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = 2 * index + 2;
+        if (left < oven->size && oven->entries[left].deadline < oven->entries[smallest].deadline)
+        {
+            smallest = left;
+        }
+        if (right < oven->size && oven->entries[right].deadline < oven->entries[smallest].deadline)
+        {
+            smallest = right;
+        }
+        if (smallest == index)
+        {
+            break;
+        }
+        swapEntries(&oven->entries[smallest], &oven->entries[index]);
+        index = smallest;
+    }
+}
+
+void initOven(Oven *oven, int capacity)
+{
+    oven->entries = malloc(capacity * sizeof(OvenEntry));
+    oven->size = 0;
+    oven->reserved = 0;
+    oven->capacity = capacity;
+    pthread_mutex_init(&oven->mutex, NULL);
+}
+
+void destroyOven(Oven *oven)
+{
+    free(oven->entries);
+    oven->entries = NULL;
+    oven->size = 0;
+    oven->capacity = 0;
+    pthread_mutex_destroy(&oven->mutex);
+}
+
+// Holds a slot for a later ovenPut, returns 0 when the oven is full
+int ovenReserveSlot(Oven *oven)
+{
+    pthread_mutex_lock(&oven->mutex);
+    int reserved = oven->size + oven->reserved < oven->capacity;
+    if (reserved)
+    {
+        oven->reserved++;
+    }
+    pthread_mutex_unlock(&oven->mutex);
+    return reserved;
+}
+
+void ovenReleaseSlot(Oven *oven)
+{
+    pthread_mutex_lock(&oven->mutex);
+    oven->reserved--;
+    pthread_mutex_unlock(&oven->mutex);
+}
+
+// Fills a slot taken with ovenReserveSlot, so it cannot fail
+void ovenPut(Oven *oven, void *data, long long deadline)
+{
+    pthread_mutex_lock(&oven->mutex);
+    oven->reserved--;
+    oven->entries[oven->size].deadline = deadline;
+    oven->entries[oven->size].data = data;
+    siftUp(oven, oven->size);
+    oven->size++;
+    pthread_mutex_unlock(&oven->mutex);
+}
+
+// Takes out the pide that is done first, if it is done by now
+void *ovenTakeReady(Oven *oven, long long now)
+{
+    pthread_mutex_lock(&oven->mutex);
+    if (oven->size == 0 || oven->entries[0].deadline > now)
+    {
+        pthread_mutex_unlock(&oven->mutex);
+        return NULL;
+    }
+    void *data = oven->entries[0].data;
+    oven->size--;
+    oven->entries[0] = oven->entries[oven->size];
+    siftDown(oven, 0);
+    pthread_mutex_unlock(&oven->mutex);
+    return data;
+}
+
+// Returns -1 when the oven is empty
+long long ovenNextDeadline(Oven *oven)
+{
+    pthread_mutex_lock(&oven->mutex);
+    long long deadline = oven->size == 0 ? -1 : oven->entries[0].deadline;
+    pthread_mutex_unlock(&oven->mutex);
+    return deadline;
+}
+
+int ovenCount(Oven *oven)
+{
+    pthread_mutex_lock(&oven->mutex);
+    int count = oven->size;
+    pthread_mutex_unlock(&oven->mutex);
+    return count;
+}
+
+// Takes out every pide matches picks, done or not, and frees their slots.
+// removed needs room for the oven capacity, returns how many were taken out.
+int ovenRemoveWhere(Oven *oven, int (*matches)(void *data, void *arg), void *arg, void **removed)
+{
+    pthread_mutex_lock(&oven->mutex);
+    int count = 0;
+    int kept = 0;
+    for (int i = 0; i < oven->size; i++)
+    {
+        if (matches(oven->entries[i].data, arg))
+        {
+            removed[count++] = oven->entries[i].data;
+        }
+        else
+        {
+            oven->entries[kept++] = oven->entries[i];
+        }
+    }
+    oven->size = kept;
+    for (int i = kept / 2 - 1; i >= 0; i--)
+    {
+        siftDown(oven, i);
+    }
+    pthread_mutex_unlock(&oven->mutex);
+    return count;
+}
+
+int ovenFreeSlots(Oven *oven)
+{
+    pthread_mutex_lock(&oven->mutex);
+    int count = oven->capacity - oven->size - oven->reserved;
+    pthread_mutex_unlock(&oven->mutex);
+    return count;
+}
@@ -0,0 +1,33 @@
+#ifndef OVEN_H
+#define OVEN_H
+
+#include <pthread.h>
+
+typedef struct
+{
+    long long deadline;
+    void *data;
+} OvenEntry;
+
+// Min-heap of pides in the oven keyed by the time they are done
+typedef struct
+{
+    OvenEntry *entries;
+    int size;
+    int reserved;
+    int capacity;
+    pthread_mutex_t mutex;
+} Oven;
+
+void initOven(Oven *oven, int capacity);
+void destroyOven(Oven *oven);
+int ovenReserveSlot(Oven *oven);
+void ovenReleaseSlot(Oven *oven);
+void ovenPut(Oven *oven, void *data, long long deadline);
+void *ovenTakeReady(Oven *oven, long long now);
+long long ovenNextDeadline(Oven *oven);
+int ovenCount(Oven *oven);
+int ovenFreeSlots(Oven *oven);
+int ovenRemoveWhere(Oven *oven, int (*matches)(void *data, void *arg), void *arg, void **removed);
+
+#endif /* OVEN_H */
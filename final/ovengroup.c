@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "ovengroup.h"
+
+static long long monotonicMicros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void initFairSemaphore(FairSemaphore *semaphore, int permits)
+{
+    pthread_condattr_t monotonicClock;
+    pthread_condattr_init(&monotonicClock);
+    pthread_condattr_setclock(&monotonicClock, CLOCK_MONOTONIC);
+    pthread_mutex_init(&semaphore->mutex, NULL);
+    pthread_cond_init(&semaphore->cond, &monotonicClock);
+    pthread_condattr_destroy(&monotonicClock);
+    semaphore->nextTicket = 0;
+    semaphore->serving = 0;
+    semaphore->available = permits;
+    semaphore->handoff = 0;
+}
+
+static void destroyFairSemaphore(FairSemaphore *semaphore)
+{
+    pthread_mutex_destroy(&semaphore->mutex);
+    pthread_cond_destroy(&semaphore->cond);
+}
+
+// Waiters take permits in ticket order, newcomers may take a free one ahead
+// of them until the oldest waiter runs out of patience
+static void fairWait(FairSemaphore *semaphore)
+{
+    pthread_mutex_lock(&semaphore->mutex);
+    if (semaphore->available > 0 && !semaphore->handoff)
+    {
+        semaphore->available--;
+        pthread_mutex_unlock(&semaphore->mutex);
+        return;
+    }
+
+    unsigned long ticket = semaphore->nextTicket++;
+    long long patience = monotonicMicros() + FAIR_PATIENCE_MICROS;
+    struct timespec wakeTime = {patience / 1000000, (patience % 1000000) * 1000};
+    while (ticket != semaphore->serving || semaphore->available == 0)
+    {
+        if (ticket == semaphore->serving && !semaphore->handoff)
+        {
+            if (pthread_cond_timedwait(&semaphore->cond, &semaphore->mutex, &wakeTime) == ETIMEDOUT)
+            {
+                semaphore->handoff = 1;
+            }
+            continue;
+        }
+        pthread_cond_wait(&semaphore->cond, &semaphore->mutex);
+    }
+    semaphore->serving++;
+    semaphore->available--;
+    semaphore->handoff = 0;
+    // The next ticket may find a permit left too
+    pthread_cond_broadcast(&semaphore->cond);
+    pthread_mutex_unlock(&semaphore->mutex);
+}
+
+static void fairPost(FairSemaphore *semaphore)
+{
+    pthread_mutex_lock(&semaphore->mutex);
+    semaphore->available++;
+    pthread_cond_broadcast(&semaphore->cond);
+    pthread_mutex_unlock(&semaphore->mutex);
+}
+
+// Parses ovens like 6:2:3,4:1:2 as capacity:doors:paddles, missing doors and
+// paddles come from defaults. Returns the number of ovens or -1 when malformed.
+int parseOvenSpecs(const char *text, OvenSpec *specs, int max, OvenSpec defaults)
+{
+    int count = 0;
+    const char *cursor = text;
+    while (*cursor != '\0')
+    {
+        if (count == max)
+        {
+            return -1;
+        }
+
+        OvenSpec spec = defaults;
+        int *fields[3] = {&spec.capacity, &spec.doors, &spec.paddles};
+        for (int i = 0; i < 3; i++)
+        {
+            char *end;
+            long value = strtol(cursor, &end, 10);
+            if (end == cursor || value <= 0 || value > 1024)
+            {
+                return -1;
+            }
+            *fields[i] = (int)value;
+            cursor = end;
+            if (*cursor != ':')
+            {
+                break;
+            }
+            cursor++;
+        }
+
+        if (*cursor == ',')
+        {
+            cursor++;
+        }
+        else if (*cursor != '\0')
+        {
+            return -1;
+        }
+        specs[count++] = spec;
+    }
+    return count > 0 ? count : -1;
+}
+
+int initOvenGroup(OvenGroup *group, const OvenSpec *specs, int count)
+{
+    group->ovens = malloc(count * sizeof(KitchenOven));
+    if (group->ovens == NULL)
+    {
+        return -1;
+    }
+    group->count = count;
+    group->maxCapacity = 0;
+    group->openedAt = monotonicMicros();
+    atomic_init(&group->nextPick, 0);
+
+    for (int i = 0; i < count; i++)
+    {
+        KitchenOven *oven = &group->ovens[i];
+        initOven(&oven->oven, specs[i].capacity);
+        oven->spec = specs[i];
+        initFairSemaphore(&oven->doors, specs[i].doors);
+        initFairSemaphore(&oven->paddles, specs[i].paddles);
+        atomic_init(&oven->occupiedMicros, 0);
+        atomic_init(&oven->toolWaitMicros, 0);
+        atomic_init(&oven->toolVisits, 0);
+        atomic_init(&oven->baked, 0);
+        if (specs[i].capacity > group->maxCapacity)
+        {
+            group->maxCapacity = specs[i].capacity;
+        }
+    }
+    return 0;
+}
+
+void destroyOvenGroup(OvenGroup *group)
+{
+    for (int i = 0; i < group->count; i++)
+    {
+        destroyOven(&group->ovens[i].oven);
+        destroyFairSemaphore(&group->ovens[i].doors);
+        destroyFairSemaphore(&group->ovens[i].paddles);
+    }
+    free(group->ovens);
+    group->ovens = NULL;
+    group->count = 0;
+}
+
+// Reserves a slot in the oven with the largest share of free slots, ties go
+// round-robin so equally empty ovens take turns. Returns the index of the
+// oven or -1 when every oven is full.
+int ovenGroupReserve(OvenGroup *group)
+{
+    unsigned int start = atomic_fetch_add_explicit(&group->nextPick, 1, memory_order_relaxed);
+    while (1)
+    {
+        int best = -1;
+        double bestShare = 0;
+        for (int i = 0; i < group->count; i++)
+        {
+            int index = (start + i) % group->count;
+            KitchenOven *oven = &group->ovens[index];
+            double share = (double)ovenFreeSlots(&oven->oven) / oven->spec.capacity;
+            if (share > bestShare)
+            {
+                best = index;
+                bestShare = share;
+            }
+        }
+
+        if (best == -1)
+        {
+            return -1;
+        }
+        if (ovenReserveSlot(&group->ovens[best].oven))
+        {
+            return best;
+        }
+        // Another cook took the last slot in between, so someone made progress
+    }
+}
+
+int ovenGroupFreeSlots(OvenGroup *group)
+{
+    int count = 0;
+    for (int i = 0; i < group->count; i++)
+    {
+        count += ovenFreeSlots(&group->ovens[i].oven);
+    }
+    return count;
+}
+
+// Earliest deadline over every oven, -1 when they are all empty
+long long ovenGroupNextDeadline(OvenGroup *group)
+{
+    long long earliest = -1;
+    for (int i = 0; i < group->count; i++)
+    {
+        long long deadline = ovenNextDeadline(&group->ovens[i].oven);
+        if (deadline != -1 && (earliest == -1 || deadline < earliest))
+        {
+            earliest = deadline;
+        }
+    }
+    return earliest;
+}
+
+// Doors before paddles on every oven, and a cook holds one oven at a time
+void enterOven(KitchenOven *oven)
+{
+    long long start = monotonicMicros();
+    fairWait(&oven->doors);
+    fairWait(&oven->paddles);
+    atomic_fetch_add_explicit(&oven->toolWaitMicros, monotonicMicros() - start, memory_order_relaxed);
+    atomic_fetch_add_explicit(&oven->toolVisits, 1, memory_order_relaxed);
+}
+
+void leaveOven(KitchenOven *oven)
+{
+    fairPost(&oven->paddles);
+    fairPost(&oven->doors);
+}
+
+// micros is how long a pide held its slot, from going in to being taken out
+void ovenRecordStay(KitchenOven *oven, long long micros)
+{
+    atomic_fetch_add_explicit(&oven->occupiedMicros, micros, memory_order_relaxed);
+    atomic_fetch_add_explicit(&oven->baked, 1, memory_order_relaxed);
+}
+
+// Share of the slot time since the group opened that pides filled
+double ovenUtilization(OvenGroup *group, KitchenOven *oven)
+{
+    long long elapsed = monotonicMicros() - group->openedAt;
+    if (elapsed <= 0)
+    {
+        return 0;
+    }
+    return (double)atomic_load(&oven->occupiedMicros) / ((double)elapsed * oven->spec.capacity);
+}
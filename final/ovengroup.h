@@ -0,0 +1,68 @@
+#ifndef OVENGROUP_H
+#define OVENGROUP_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "oven.h"
+
+#define MAX_OVENS 16
+
+#define FAIR_PATIENCE_MICROS 10000
+
+// Counting semaphore where waiters queue by ticket. A free permit goes to
+// whoever asks, so a running cook does not wait for a sleeping one to be
+// scheduled, until the oldest waiter has waited FAIR_PATIENCE_MICROS. Then
+// permits are handed to it first, so no cook is overtaken forever.
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned long nextTicket;
+    unsigned long serving;
+    int available;
+    int handoff;
+} FairSemaphore;
+
+typedef struct
+{
+    int capacity;
+    int doors;
+    int paddles;
+} OvenSpec;
+
+// One oven with its own slots, doors and paddles. A cook holds a door and a
+// paddle of the oven while it puts pides in or takes them out.
+typedef struct
+{
+    Oven oven;
+    OvenSpec spec;
+    FairSemaphore doors;
+    FairSemaphore paddles;
+    atomic_llong occupiedMicros; // slot time taken by pides that left the oven
+    atomic_llong toolWaitMicros;
+    atomic_long toolVisits;
+    atomic_long baked;
+} KitchenOven;
+
+typedef struct
+{
+    KitchenOven *ovens;
+    int count;
+    int maxCapacity;
+    long long openedAt; // CLOCK_MONOTONIC microseconds, like the stamps on the orders
+    atomic_uint nextPick; // rotates between ovens that are equally full
+} OvenGroup;
+
+int parseOvenSpecs(const char *text, OvenSpec *specs, int max, OvenSpec defaults);
+int initOvenGroup(OvenGroup *group, const OvenSpec *specs, int count);
+void destroyOvenGroup(OvenGroup *group);
+int ovenGroupReserve(OvenGroup *group);
+int ovenGroupFreeSlots(OvenGroup *group);
+long long ovenGroupNextDeadline(OvenGroup *group);
+void enterOven(KitchenOven *oven);
+void leaveOven(KitchenOven *oven);
+void ovenRecordStay(KitchenOven *oven, long long micros);
+double ovenUtilization(OvenGroup *group, KitchenOven *oven);
+
+#endif /* OVENGROUP_H */
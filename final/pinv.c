@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <complex.h>
+
+#include "pinv.h"
+
+#define PINV_MAX_SWEEPS 30
+#define PINV_ALIGNMENT 64
+
+// The pseudo-inverse comes from a one-sided Jacobi SVD of B = A^H (40x30).
+// Columns of B are rotated pairwise until they are orthogonal, giving
+// B V = W with W = U S. Then A+ = U S^-1 V^H = sum_k w_k v_k^H / s_k^2.
+//
+// Columns are kept as separate real and imaginary arrays (split complex),
+// each contiguous and 64 byte aligned, so a column pair stays in a few cache
+// lines and the inner loops vectorize. The whole working set (~30 KB) fits
+// in L1, so the final product is tiled over output columns instead of
+// blocked further.
+
+#define WORK_STRIDE PINV_COLS
+#define ROTATION_STRIDE PINV_ROWS
+
+static double *alignedArray(size_t count)
+{
+    size_t bytes = (count * sizeof(double) + PINV_ALIGNMENT - 1) / PINV_ALIGNMENT * PINV_ALIGNMENT;
+    return aligned_alloc(PINV_ALIGNMENT, bytes);
+}
+
+PinvScratch *createPinvScratch()
+{
+    PinvScratch *scratch = aligned_alloc(PINV_ALIGNMENT, (sizeof(PinvScratch) + PINV_ALIGNMENT - 1) / PINV_ALIGNMENT * PINV_ALIGNMENT);
+    if (scratch == NULL)
+    {
+        return NULL;
+    }
+    scratch->workRe = alignedArray(PINV_ROWS * WORK_STRIDE);
+    scratch->workIm = alignedArray(PINV_ROWS * WORK_STRIDE);
+    scratch->rotationRe = alignedArray(PINV_ROWS * ROTATION_STRIDE);
+    scratch->rotationIm = alignedArray(PINV_ROWS * ROTATION_STRIDE);
+    scratch->norms = alignedArray(PINV_ROWS);
+    scratch->sweeps = 0;
+    if (scratch->workRe == NULL || scratch->workIm == NULL || scratch->rotationRe == NULL ||
+        scratch->rotationIm == NULL || scratch->norms == NULL)
+    {
+        destroyPinvScratch(scratch);
+        return NULL;
+    }
+    return scratch;
+}
+
+void destroyPinvScratch(PinvScratch *scratch)
+{
+    if (scratch == NULL)
+    {
+        return;
+    }
+    free(scratch->workRe);
+    free(scratch->workIm);
+    free(scratch->rotationRe);
+    free(scratch->rotationIm);
+    free(scratch->norms);
+    free(scratch);
+}
+
+// xorshift keeps the cooks off the shared rand() state
+void fillRandomMatrix(PinvScratch *scratch, unsigned int seed)
+{
+    unsigned int state = seed * 2654435761u + 1;
+    for (int i = 0; i < PINV_ROWS; i++)
+    {
+        for (int j = 0; j < PINV_COLS; j++)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            double re = (double)(state & 0xffff) / 32768.0 - 1.0;
+            double im = (double)(state >> 16) / 32768.0 - 1.0;
+            scratch->input[i][j] = re + im * I;
+        }
+    }
+}
+
+// gamma = x^H y
+__attribute__((target_clones("avx2", "default"))) static void columnProducts(const double *restrict xRe, const double *restrict xIm, const double *restrict yRe, const double *restrict yIm, int length, double *xx, double *yy, double *gammaRe, double *gammaIm)
+{
+    double sumXX = 0, sumYY = 0, sumRe = 0, sumIm = 0;
+    for (int i = 0; i < length; i++)
+    {
+        sumXX += xRe[i] * xRe[i] + xIm[i] * xIm[i];
+        sumYY += yRe[i] * yRe[i] + yIm[i] * yIm[i];
+        sumRe += xRe[i] * yRe[i] + xIm[i] * yIm[i];
+        sumIm += xRe[i] * yIm[i] - xIm[i] * yRe[i];
+    }
+    *xx = sumXX;
+    *yy = sumYY;
+    *gammaRe = sumRe;
+    *gammaIm = sumIm;
+}
+
+// x' = c x - s e y, y' = s x + c e y with e = conj(gamma) / |gamma|
+__attribute__((target_clones("avx2", "default"))) static void rotateColumns(double *restrict xRe, double *restrict xIm, double *restrict yRe, double *restrict yIm, int length, double c, double s, double eRe, double eIm)
+{
+    for (int i = 0; i < length; i++)
+    {
+        double phasedRe = eRe * yRe[i] - eIm * yIm[i];
+        double phasedIm = eRe * yIm[i] + eIm * yRe[i];
+        double newXRe = c * xRe[i] - s * phasedRe;
+        double newXIm = c * xIm[i] - s * phasedIm;
+        yRe[i] = s * xRe[i] + c * phasedRe;
+        yIm[i] = s * xIm[i] + c * phasedIm;
+        xRe[i] = newXRe;
+        xIm[i] = newXIm;
+    }
+}
+
+// Returns the number of singular values kept, the result is in scratch->result
+int computePseudoInverse(PinvScratch *scratch)
+{
+    double *workRe = scratch->workRe;
+    double *workIm = scratch->workIm;
+    double *rotationRe = scratch->rotationRe;
+    double *rotationIm = scratch->rotationIm;
+
+    // Column k of B = A^H is the conjugate of row k of A
+    for (int k = 0; k < PINV_ROWS; k++)
+    {
+        for (int i = 0; i < PINV_COLS; i++)
+        {
+            workRe[k * WORK_STRIDE + i] = creal(scratch->input[k][i]);
+            workIm[k * WORK_STRIDE + i] = -cimag(scratch->input[k][i]);
+        }
+    }
+    memset(rotationRe, 0, PINV_ROWS * ROTATION_STRIDE * sizeof(double));
+    memset(rotationIm, 0, PINV_ROWS * ROTATION_STRIDE * sizeof(double));
+    for (int k = 0; k < PINV_ROWS; k++)
+    {
+        rotationRe[k * ROTATION_STRIDE + k] = 1.0;
+    }
+
+    int sweep;
+    for (sweep = 0; sweep < PINV_MAX_SWEEPS; sweep++)
+    {
+        int rotated = 0;
+        for (int p = 0; p < PINV_ROWS - 1; p++)
+        {
+            for (int q = p + 1; q < PINV_ROWS; q++)
+            {
+                double alpha, beta, gammaRe, gammaIm;
+                columnProducts(workRe + p * WORK_STRIDE, workIm + p * WORK_STRIDE, workRe + q * WORK_STRIDE, workIm + q * WORK_STRIDE, PINV_COLS, &alpha, &beta, &gammaRe, &gammaIm);
+
+                double gamma = hypot(gammaRe, gammaIm);
+                if (gamma <= DBL_EPSILON * sqrt(alpha * beta) || gamma == 0.0)
+                {
+                    continue;
+                }
+                rotated = 1;
+
+                double zeta = (beta - alpha) / (2.0 * gamma);
+                double t = (zeta >= 0 ? 1.0 : -1.0) / (fabs(zeta) + sqrt(1.0 + zeta * zeta));
+                double c = 1.0 / sqrt(1.0 + t * t);
+                double s = c * t;
+                double eRe = gammaRe / gamma;
+                double eIm = -gammaIm / gamma;
+
+                rotateColumns(workRe + p * WORK_STRIDE, workIm + p * WORK_STRIDE, workRe + q * WORK_STRIDE, workIm + q * WORK_STRIDE, PINV_COLS, c, s, eRe, eIm);
+                rotateColumns(rotationRe + p * ROTATION_STRIDE, rotationIm + p * ROTATION_STRIDE, rotationRe + q * ROTATION_STRIDE, rotationIm + q * ROTATION_STRIDE, PINV_ROWS, c, s, eRe, eIm);
+            }
+        }
+        if (!rotated)
+        {
+            break;
+        }
+    }
+    scratch->sweeps = sweep;
+
+    // Squared singular values, tiny ones are treated as zero
+    double largest = 0;
+    for (int k = 0; k < PINV_ROWS; k++)
+    {
+        double sum = 0;
+        for (int i = 0; i < PINV_COLS; i++)
+        {
+            sum += workRe[k * WORK_STRIDE + i] * workRe[k * WORK_STRIDE + i] + workIm[k * WORK_STRIDE + i] * workIm[k * WORK_STRIDE + i];
+        }
+        scratch->norms[k] = sum;
+        if (sum > largest)
+        {
+            largest = sum;
+        }
+    }
+    double tolerance = PINV_COLS * DBL_EPSILON * sqrt(largest);
+    int rank = 0;
+    for (int k = 0; k < PINV_ROWS; k++)
+    {
+        if (sqrt(scratch->norms[k]) > tolerance)
+        {
+            scratch->norms[k] = 1.0 / scratch->norms[k];
+            rank++;
+        }
+        else
+        {
+            scratch->norms[k] = 0.0;
+        }
+    }
+
+    // A+[i][j] = sum_k W[i][k] conj(V[j][k]) / s_k^2
+    for (int i = 0; i < PINV_COLS; i++)
+    {
+        for (int j = 0; j < PINV_ROWS; j++)
+        {
+            double sumRe = 0, sumIm = 0;
+            for (int k = 0; k < PINV_ROWS; k++)
+            {
+                double wRe = workRe[k * WORK_STRIDE + i] * scratch->norms[k];
+                double wIm = workIm[k * WORK_STRIDE + i] * scratch->norms[k];
+                double vRe = rotationRe[k * ROTATION_STRIDE + j];
+                double vIm = -rotationIm[k * ROTATION_STRIDE + j];
+                sumRe += wRe * vRe - wIm * vIm;
+                sumIm += wRe * vIm + wIm * vRe;
+            }
+            scratch->result[i][j] = sumRe + sumIm * I;
+        }
+    }
+
+    return rank;
+}
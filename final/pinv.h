@@ -0,0 +1,27 @@
+#ifndef PINV_H
+#define PINV_H
+
+#include <complex.h>
+
+#define PINV_ROWS 30
+#define PINV_COLS 40
+
+// Everything one pseudo-inverse needs, allocated once per cook
+typedef struct
+{
+    double complex input[PINV_ROWS][PINV_COLS];
+    double complex result[PINV_COLS][PINV_ROWS];
+    double *workRe;
+    double *workIm;
+    double *rotationRe;
+    double *rotationIm;
+    double *norms;
+    int sweeps;
+} PinvScratch;
+
+PinvScratch *createPinvScratch();
+void destroyPinvScratch(PinvScratch *scratch);
+void fillRandomMatrix(PinvScratch *scratch, unsigned int seed);
+int computePseudoInverse(PinvScratch *scratch);
+
+#endif /* PINV_H */
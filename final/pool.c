@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pool.h"
+
+void initObjectPool(ObjectPool *pool, size_t objectSize)
+{
+    size_t alignment = _Alignof(max_align_t);
+    if (objectSize < sizeof(PoolObject))
+    {
+        objectSize = sizeof(PoolObject);
+    }
+    pool->objectSize = (objectSize + alignment - 1) / alignment * alignment;
+    pool->freeList = NULL;
+    pool->slabs = NULL;
+    pthread_mutex_init(&pool->mutex, NULL);
+    atomic_init(&pool->allocations, 0);
+    atomic_init(&pool->slabAllocations, 0);
+}
+
+// Releases every object at once, live or not
+void destroyObjectPool(ObjectPool *pool)
+{
+    void *slab = pool->slabs;
+    while (slab != NULL)
+    {
+        void *nextSlab = *(void **)slab;
+        free(slab);
+        slab = nextSlab;
+    }
+    pool->slabs = NULL;
+    pool->freeList = NULL;
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+void initPoolCache(PoolCache *cache)
+{
+    cache->head = NULL;
+    cache->count = 0;
+    cache->allocations = 0;
+}
+
+static void moveToPool(ObjectPool *pool, PoolCache *cache, int count)
+{
+    pthread_mutex_lock(&pool->mutex);
+    while (count-- > 0 && cache->head != NULL)
+    {
+        PoolObject *object = cache->head;
+        cache->head = object->next;
+        cache->count--;
+        object->next = pool->freeList;
+        pool->freeList = object;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static void refillCache(ObjectPool *pool, PoolCache *cache)
+{
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->freeList == NULL)
+    {
+        // Slabs start with a pointer to the next slab, objects follow it
+        size_t header = _Alignof(max_align_t) > sizeof(void *) ? _Alignof(max_align_t) : sizeof(void *);
+        char *slab = malloc(header + pool->objectSize * POOL_SLAB_OBJECTS);
+        if (slab == NULL)
+        {
+            pthread_mutex_unlock(&pool->mutex);
+            return;
+        }
+        *(void **)slab = pool->slabs;
+        pool->slabs = slab;
+        atomic_fetch_add_explicit(&pool->slabAllocations, 1, memory_order_relaxed);
+
+        for (int i = POOL_SLAB_OBJECTS - 1; i >= 0; i--)
+        {
+            PoolObject *object = (PoolObject *)(slab + header + i * pool->objectSize);
+            object->next = pool->freeList;
+            pool->freeList = object;
+        }
+    }
+
+    for (int i = 0; i < POOL_CACHE_BATCH && pool->freeList != NULL; i++)
+    {
+        PoolObject *object = pool->freeList;
+        pool->freeList = object->next;
+        object->next = cache->head;
+        cache->head = object;
+        cache->count++;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    atomic_fetch_add_explicit(&pool->allocations, cache->allocations, memory_order_relaxed);
+    cache->allocations = 0;
+}
+
+// Called by the owning thread before it exits
+void flushPoolCache(ObjectPool *pool, PoolCache *cache)
+{
+    moveToPool(pool, cache, cache->count);
+    atomic_fetch_add_explicit(&pool->allocations, cache->allocations, memory_order_relaxed);
+    cache->allocations = 0;
+}
+
+void *poolAlloc(ObjectPool *pool, PoolCache *cache)
+{
+    if (cache->head == NULL)
+    {
+        refillCache(pool, cache);
+        if (cache->head == NULL)
+        {
+            return NULL;
+        }
+    }
+    PoolObject *object = cache->head;
+    cache->head = object->next;
+    cache->count--;
+    cache->allocations++;
+    return object;
+}
+
+// Objects may be freed by a different thread than the one that allocated them
+void poolFree(ObjectPool *pool, PoolCache *cache, void *object)
+{
+    PoolObject *pooled = (PoolObject *)object;
+    pooled->next = cache->head;
+    cache->head = pooled;
+    cache->count++;
+    if (cache->count > 2 * POOL_CACHE_BATCH)
+    {
+        moveToPool(pool, cache, POOL_CACHE_BATCH);
+    }
+}
+
+long poolAllocations(ObjectPool *pool)
+{
+    return atomic_load_explicit(&pool->allocations, memory_order_relaxed);
+}
+
+// Every slab is the only malloc behind POOL_SLAB_OBJECTS allocations
+long poolMallocs(ObjectPool *pool)
+{
+    return atomic_load_explicit(&pool->slabAllocations, memory_order_relaxed);
+}
@@ -0,0 +1,44 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define POOL_SLAB_OBJECTS 256
+#define POOL_CACHE_BATCH 32
+
+typedef struct PoolObject
+{
+    struct PoolObject *next;
+} PoolObject;
+
+// Objects owned by one thread, moved to and from the pool in batches
+typedef struct
+{
+    PoolObject *head;
+    int count;
+    long allocations;
+} PoolCache;
+
+// Fixed size objects carved out of slabs, slabs are only released by destroyObjectPool
+typedef struct
+{
+    size_t objectSize;
+    PoolObject *freeList;
+    void *slabs;
+    pthread_mutex_t mutex;
+    atomic_long allocations;
+    atomic_long slabAllocations;
+} ObjectPool;
+
+void initObjectPool(ObjectPool *pool, size_t objectSize);
+void destroyObjectPool(ObjectPool *pool);
+void initPoolCache(PoolCache *cache);
+void flushPoolCache(ObjectPool *pool, PoolCache *cache);
+void *poolAlloc(ObjectPool *pool, PoolCache *cache);
+void poolFree(ObjectPool *pool, PoolCache *cache, void *object);
+long poolAllocations(ObjectPool *pool);
+long poolMallocs(ObjectPool *pool);
+
+#endif /* POOL_H */
@@ -0,0 +1,64 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+
+void encodeFrameHeader(char *buffer, int type, uint32_t length)
+{
+    buffer[0] = PROTOCOL_VERSION;
+    buffer[1] = type;
+    buffer[2] = 0;
+    buffer[3] = 0;
+    uint32_t networkLength = htonl(length);
+    memcpy(buffer + 4, &networkLength, sizeof(networkLength));
+}
+
+void decodeFrameHeader(const char *buffer, FrameHeader *header)
+{
+    uint32_t networkLength;
+    memcpy(&networkLength, buffer + 4, sizeof(networkLength));
+    header->version = (unsigned char)buffer[0];
+    header->type = (unsigned char)buffer[1];
+    header->length = ntohl(networkLength);
+}
+
+// Checks the version, the direction and that the payload fits the type
+int isValidFrame(FrameHeader *header, int fromClient)
+{
+    if (header->version != PROTOCOL_VERSION || header->length > MAX_FRAME_PAYLOAD)
+    {
+        return 0;
+    }
+
+    switch (header->type)
+    {
+    case FRAME_ORDERS:
+        return fromClient && header->length % ORDER_RECORD_SIZE == 0;
+    case FRAME_END:
+        return fromClient && header->length == COUNT_PAYLOAD_SIZE;
+    case FRAME_CANCEL:
+        return fromClient && header->length == 0;
+    case FRAME_ACK:
+    case FRAME_DONE:
+        return !fromClient && header->length == COUNT_PAYLOAD_SIZE;
+    case FRAME_DELIVERED:
+        return !fromClient && header->length % DELIVERED_RECORD_SIZE == 0;
+    case FRAME_BUSY:
+        return !fromClient && header->length % BUSY_RECORD_SIZE == 0;
+    default:
+        return 0;
+    }
+}
+
+void encodeInt(char *buffer, int value)
+{
+    uint32_t networkValue = htonl((uint32_t)value);
+    memcpy(buffer, &networkValue, sizeof(networkValue));
+}
+
+int decodeInt(const char *buffer)
+{
+    uint32_t networkValue;
+    memcpy(&networkValue, buffer, sizeof(networkValue));
+    return (int)ntohl(networkValue);
+}
@@ -0,0 +1,44 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+// Every frame starts with an 8 byte header, all integers are big-endian:
+//   uint8 version, uint8 type, uint16 reserved, uint32 payload length
+#define PROTOCOL_VERSION 1
+#define FRAME_HEADER_SIZE 8
+#define MAX_FRAME_PAYLOAD (1 << 20)
+
+// Client to shop
+#define FRAME_ORDERS 1 // customerId, p, q records of ORDER_RECORD_SIZE bytes
+#define FRAME_END 2    // number of orders sent, no more orders follow
+#define FRAME_CANCEL 3 // no payload
+
+// Shop to client
+#define FRAME_ACK 4       // number of orders taken so far
+#define FRAME_DELIVERED 5 // customerId records of DELIVERED_RECORD_SIZE bytes
+#define FRAME_DONE 6      // number of orders delivered
+#define FRAME_BUSY 7      // customerId, retry after ms records of BUSY_RECORD_SIZE bytes
+
+// A busy record for NO_CUSTOMER means the whole connection was refused
+#define NO_CUSTOMER -1
+
+#define ORDER_RECORD_SIZE 12
+#define DELIVERED_RECORD_SIZE 4
+#define BUSY_RECORD_SIZE 8
+#define COUNT_PAYLOAD_SIZE 4
+
+typedef struct
+{
+    int version;
+    int type;
+    uint32_t length;
+} FrameHeader;
+
+void encodeFrameHeader(char *buffer, int type, uint32_t length);
+void decodeFrameHeader(const char *buffer, FrameHeader *header);
+int isValidFrame(FrameHeader *header, int fromClient);
+void encodeInt(char *buffer, int value);
+int decodeInt(const char *buffer);
+
+#endif /* PROTOCOL_H */
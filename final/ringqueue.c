@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "ringqueue.h"
+
+// Every cell carries a sequence number telling whose turn it is: a producer
+// may fill cell i when sequence == position, a consumer may empty it when
+// sequence == position + 1. Positions are claimed with a single CAS.
+
+int initRingQueue(RingQueue *queue, size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    queue->cells = malloc(size * sizeof(RingCell));
+    if (queue->cells == NULL)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+        atomic_init(&queue->cells[i].sequence, i);
+        queue->cells[i].data = NULL;
+    }
+    queue->mask = size - 1;
+    atomic_init(&queue->enqueuePos, 0);
+    atomic_init(&queue->dequeuePos, 0);
+    return 0;
+}
+
+void destroyRingQueue(RingQueue *queue)
+{
+    free(queue->cells);
+    queue->cells = NULL;
+    queue->mask = 0;
+}
+
+int ringIsEmpty(RingQueue *queue)
+{
+    return ringSize(queue) == 0;
+}
+
+size_t ringSize(RingQueue *queue)
+{
+    size_t dequeuePos = atomic_load_explicit(&queue->dequeuePos, memory_order_acquire);
+    size_t enqueuePos = atomic_load_explicit(&queue->enqueuePos, memory_order_acquire);
+    return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+}
+
+// Returns 0 when the queue is full
+int ringEnqueue(RingQueue *queue, void *data)
+{
+    RingCell *cell;
+    size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    while (1)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)pos;
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            return 0;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    cell->data = data;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return 1;
+}
+
+// Returns NULL when the queue is empty
+void *ringDequeue(RingQueue *queue)
+{
+    RingCell *cell;
+    size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    while (1)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            return NULL;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        }
+    }
+
+    void *data = cell->data;
+    atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+    return data;
+}
+
+// Only safe once producers and consumers are stopped
+void clearRingQueue(RingQueue *queue)
+{
+    void *data;
+    while ((data = ringDequeue(queue)) != NULL)
+    {
+        free(data);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef RINGQUEUE_H
+#define RINGQUEUE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct
+{
+    atomic_size_t sequence;
+    void *data;
+} RingCell;
+
+// Bounded multi-producer/multi-consumer queue, capacity is rounded up to a power of two
+typedef struct
+{
+    RingCell *cells;
+    size_t mask;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueuePos;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeuePos;
+} RingQueue;
+
+int initRingQueue(RingQueue *queue, size_t capacity);
+void destroyRingQueue(RingQueue *queue);
+int ringIsEmpty(RingQueue *queue);
+size_t ringSize(RingQueue *queue);
+int ringEnqueue(RingQueue *queue, void *data);
+void *ringDequeue(RingQueue *queue);
+void clearRingQueue(RingQueue *queue);
+
+#endif /* RINGQUEUE_H */
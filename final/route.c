@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "route.h"
+
+int initRouteBoard(RouteBoard *board, int capacity)
+{
+    board->stops = malloc(capacity * sizeof(RouteStop));
+    if (board->stops == NULL)
+    {
+        return -1;
+    }
+    board->count = 0;
+    board->capacity = capacity;
+    return 0;
+}
+
+void destroyRouteBoard(RouteBoard *board)
+{
+    free(board->stops);
+    board->stops = NULL;
+    board->count = 0;
+    board->capacity = 0;
+}
+
+// Returns 0 if the board is full
+int routeBoardAdd(RouteBoard *board, int p, int q, void *data)
+{
+    if (board->count == board->capacity)
+    {
+        return 0;
+    }
+    board->stops[board->count].p = p;
+    board->stops[board->count].q = q;
+    board->stops[board->count].data = data;
+    board->count++;
+    return 1;
+}
+
+int routeBoardCount(RouteBoard *board)
+{
+    return board->count;
+}
+
+// Takes out every stop matches picks, the rest keep their order. removed
+// needs room for the whole board, returns how many were taken out.
+int routeBoardRemoveWhere(RouteBoard *board, int (*matches)(void *data, void *arg), void *arg, void **removed)
+{
+    int count = 0;
+    int kept = 0;
+    for (int i = 0; i < board->count; i++)
+    {
+        if (matches(board->stops[i].data, arg))
+        {
+            removed[count++] = board->stops[i].data;
+        }
+        else
+        {
+            board->stops[kept++] = board->stops[i];
+        }
+    }
+    board->count = kept;
+    return count;
+}
+
+// Travel time between two points grows with the squared distance
+long long legCost(int fromP, int fromQ, int toP, int toQ)
+{
+    long long dp = fromP - toP;
+    long long dq = fromQ - toQ;
+    return dp * dp + dq * dq;
+}
+
+// Takes the oldest order, so nothing waits forever, and groups it with the
+// orders closest to the group built so far. Returns the number taken.
+int takeRouteBatch(RouteBoard *board, RouteStop *batch, int maxStops)
+{
+    if (board->count == 0 || maxStops <= 0)
+    {
+        return 0;
+    }
+
+    // Picked entries are marked by clearing data, then the board is compacted
+    batch[0] = board->stops[0];
+    board->stops[0].data = NULL;
+    int taken = 1;
+
+    while (taken < maxStops)
+    {
+        int best = -1;
+        long long bestCost = LLONG_MAX;
+        for (int i = 1; i < board->count; i++)
+        {
+            if (board->stops[i].data == NULL)
+            {
+                continue;
+            }
+            for (int j = 0; j < taken; j++)
+            {
+                long long cost = legCost(batch[j].p, batch[j].q, board->stops[i].p, board->stops[i].q);
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    best = i;
+                }
+            }
+        }
+        if (best == -1)
+        {
+            break;
+        }
+        batch[taken++] = board->stops[best];
+        board->stops[best].data = NULL;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < board->count; i++)
+    {
+        if (board->stops[i].data != NULL)
+        {
+            board->stops[kept++] = board->stops[i];
+        }
+    }
+    board->count = kept;
+
+    return taken;
+}
+
+static long long stopCost(RouteStop *stops, int count, int from, int to, int startP, int startQ)
+{
+    int fromP = from < 0 || from >= count ? startP : stops[from].p;
+    int fromQ = from < 0 || from >= count ? startQ : stops[from].q;
+    int toP = to < 0 || to >= count ? startP : stops[to].p;
+    int toQ = to < 0 || to >= count ? startQ : stops[to].q;
+    return legCost(fromP, fromQ, toP, toQ);
+}
+
+// Orders the stops of a round trip from (startP, startQ) with nearest
+// neighbour followed by 2-opt. Returns the cost of the whole trip.
+long long planRoute(RouteStop *stops, int count, int startP, int startQ)
+{
+    int atP = startP;
+    int atQ = startQ;
+    for (int i = 0; i < count; i++)
+    {
+        int nearest = i;
+        for (int j = i + 1; j < count; j++)
+        {
+            if (legCost(atP, atQ, stops[j].p, stops[j].q) < legCost(atP, atQ, stops[nearest].p, stops[nearest].q))
+            {
+                nearest = j;
+            }
+        }
+        RouteStop temp = stops[i];
+        stops[i] = stops[nearest];
+        stops[nearest] = temp;
+        atP = stops[i].p;
+        atQ = stops[i].q;
+    }
+
+    // Reversing stops[i..j] only changes the two edges around the segment,
+    // -1 and count both stand for the starting point
+    int improved = 1;
+    while (improved)
+    {
+        improved = 0;
+        for (int i = 0; i < count - 1; i++)
+        {
+            for (int j = i + 1; j < count; j++)
+            {
+                long long before = stopCost(stops, count, i - 1, i, startP, startQ) + stopCost(stops, count, j, j + 1, startP, startQ);
+                long long after = stopCost(stops, count, i - 1, j, startP, startQ) + stopCost(stops, count, i, j + 1, startP, startQ);
+                if (after < before)
+                {
+                    for (int a = i, b = j; a < b; a++, b--)
+                    {
+                        RouteStop temp = stops[a];
+                        stops[a] = stops[b];
+                        stops[b] = temp;
+                    }
+                    improved = 1;
+                }
+            }
+        }
+    }
+
+    long long total = 0;
+    for (int i = 0; i <= count; i++)
+    {
+        total += stopCost(stops, count, i - 1, i, startP, startQ);
+    }
+    return total;
+}
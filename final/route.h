@@ -0,0 +1,29 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+
+typedef struct
+{
+    int p;
+    int q;
+    void *data;
+} RouteStop;
+
+// Ready orders waiting for a courier, oldest first. Not synchronised,
+// the caller holds the lock that guards the board.
+typedef struct
+{
+    RouteStop *stops;
+    int count;
+    int capacity;
+} RouteBoard;
+
+int initRouteBoard(RouteBoard *board, int capacity);
+void destroyRouteBoard(RouteBoard *board);
+int routeBoardAdd(RouteBoard *board, int p, int q, void *data);
+int routeBoardCount(RouteBoard *board);
+int routeBoardRemoveWhere(RouteBoard *board, int (*matches)(void *data, void *arg), void *arg, void **removed);
+int takeRouteBatch(RouteBoard *board, RouteStop *batch, int maxStops);
+long long legCost(int fromP, int fromQ, int toP, int toQ);
+long long planRoute(RouteStop *stops, int count, int startP, int startQ);
+
+#endif /* ROUTE_H */
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "stats.h"
+
+void initStatsBlock(StatsBlock *stats)
+{
+    for (int i = 0; i < STAT_COUNT; i++)
+    {
+        atomic_init(&stats->counters[i].value, 0);
+    }
+}
+
+// Release pairs with the acquire loads in takeStatsSnapshot, an order has to
+// advance a counter only after it advanced every earlier one
+void statAdvance(StatsBlock *stats, int stat)
+{
+    atomic_fetch_add_explicit(&stats->counters[stat].value, 1, memory_order_release);
+}
+
+int statGet(StatsBlock *stats, int stat)
+{
+    return atomic_load_explicit(&stats->counters[stat].value, memory_order_acquire);
+}
+
+// Reads from the end of the pipeline back to the start. Every order counted in
+// a later counter was counted in the earlier ones before, so no stage of the
+// snapshot ever comes out negative, without locking out the writers.
+void takeStatsSnapshot(StatsBlock *stats, StatsSnapshot *snapshot)
+{
+    for (int i = STAT_COUNT - 1; i >= 0; i--)
+    {
+        snapshot->counts[i] = statGet(stats, i);
+    }
+}
+
+// Orders that reached stat but not the next point, STAT_DELIVERED and STAT_DROPPED are totals
+int snapshotWaiting(StatsSnapshot *snapshot, int stat)
+{
+    if (stat == STAT_DELIVERED)
+    {
+        return snapshot->counts[stat] - snapshot->counts[STAT_DROPPED];
+    }
+    if (stat == STAT_DROPPED)
+    {
+        return snapshot->counts[stat];
+    }
+    return snapshot->counts[stat] - snapshot->counts[stat + 1];
+}
@@ -0,0 +1,46 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+
+#define STATS_CACHE_LINE_SIZE 64
+
+// Cumulative number of orders that reached each point of the pipeline. Every
+// order advances them in this order, so each counter is at most the one before it.
+#define STAT_RECEIVED 0
+#define STAT_PREP_STARTED 1
+#define STAT_PREPARED 2
+#define STAT_OVEN_IN 3
+#define STAT_COOKED 4
+#define STAT_PICKED_UP 5
+#define STAT_DELIVERED 6
+
+// Orders that left the pipeline early, dropped by the admission policy or
+// cancelled. They still advance every later counter first, so STAT_DELIVERED
+// counts them too and every stage in between stays exact.
+#define STAT_DROPPED 7
+#define STAT_COUNT 8
+
+// Counters are written by different threads, each gets its own cache line
+typedef struct
+{
+    _Alignas(STATS_CACHE_LINE_SIZE) atomic_int value;
+} StatCounter;
+
+typedef struct
+{
+    StatCounter counters[STAT_COUNT];
+} StatsBlock;
+
+typedef struct
+{
+    int counts[STAT_COUNT];
+} StatsSnapshot;
+
+void initStatsBlock(StatsBlock *stats);
+void statAdvance(StatsBlock *stats, int stat);
+int statGet(StatsBlock *stats, int stat);
+void takeStatsSnapshot(StatsBlock *stats, StatsSnapshot *snapshot);
+int snapshotWaiting(StatsSnapshot *snapshot, int stat);
+
+#endif /* STATS_H */
@@ -4,11 +4,19 @@
 #include <pthread.h>
 #include <time.h>
 #include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include "buffer.h"
 #include "stats.h"
 #include "thread_args.h"
+#include "copy.h"
+#include "uring.h"
 
 #define MAX_BUFFER_SIZE 512
+#define DEFAULT_SCANNERS 4
+#define DEFAULT_BATCH_FILES 32
+// Descriptors left for stdio, the tree roots and anything else besides the copies
+#define FILES_LIMIT_RESERVE 64
 
 void *manager_function(void *arg);
 void *worker_function(void *arg);
@@ -34,16 +42,69 @@ void handle_sigint(int sig)
 
 int main(int argc, char *argv[])
 {
-    if (argc != 5)
+    int engine = COPY_ENGINE_AUTO;
+    int uring_depth = URING_DEPTH;
+    int scanners = DEFAULT_SCANNERS;
+    int batch_files = DEFAULT_BATCH_FILES;
+    int option;
+    while ((option = getopt(argc, argv, "e:q:s:b:")) != -1)
+    {
+        switch (option)
+        {
+        case 'e':
+            engine = copy_engine_from_name(optarg);
+            if (engine < 0)
+            {
+                printf("Copy engine must be one of auto, reflink, copy_file_range, sendfile, rw, uring\n");
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'q':
+            uring_depth = atoi(optarg);
+            if (uring_depth <= 0)
+            {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            scanners = atoi(optarg);
+            if (scanners <= 0)
+            {
+                print_usage();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b':
+            batch_files = atoi(optarg);
+            if (batch_files <= 0 || batch_files > TRANSACTION_BATCH_MAX)
+            {
+                printf("Batch size must be between 1 and %d\n", TRANSACTION_BATCH_MAX);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 4)
     {
         print_usage();
         return EXIT_FAILURE;
     }
 
-    int buffer_size = atoi(argv[1]);
-    int num_workers = atoi(argv[2]);
-    char *source_dir = argv[3];
-    char *dest_dir = argv[4];
+    // Batches are copied with read and write, so a forced kernel-side engine copies every file alone
+    if (engine == COPY_ENGINE_REFLINK || engine == COPY_ENGINE_COPY_FILE_RANGE || engine == COPY_ENGINE_SENDFILE)
+    {
+        batch_files = 1;
+    }
+
+    int buffer_size = atoi(argv[optind]);
+    int num_workers = atoi(argv[optind + 1]);
+    char *source_dir = argv[optind + 2];
+    char *dest_dir = argv[optind + 3];
 
     if (buffer_size <= 0 || num_workers <= 0)
     {
@@ -67,6 +128,37 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    // Every file waiting in the buffer holds two descriptors, so take all the
+    // descriptors the system allows
+    struct rlimit files_limit;
+    if (getrlimit(RLIMIT_NOFILE, &files_limit) == 0)
+    {
+        struct rlimit raised = files_limit;
+        raised.rlim_cur = raised.rlim_max;
+        if (files_limit.rlim_cur < files_limit.rlim_max && setrlimit(RLIMIT_NOFILE, &raised) == 0)
+        {
+            files_limit = raised;
+        }
+
+        // A batch keeps its files open until a worker copies it, and one can
+        // wait in every buffer slot, in every scanner and in every worker, so
+        // batches get smaller when all of them would not fit under the limit
+        rlim_t batches = (rlim_t)buffer_size + scanners + num_workers;
+        rlim_t reserved = FILES_LIMIT_RESERVE + (rlim_t)scanners * 3;
+        if (engine == COPY_ENGINE_URING)
+        {
+            reserved += (rlim_t)num_workers * (2 * uring_depth + 1);
+        }
+        if (files_limit.rlim_cur != RLIM_INFINITY)
+        {
+            rlim_t fit = files_limit.rlim_cur > reserved ? (files_limit.rlim_cur - reserved) / (2 * batches) : 0;
+            if (fit < (rlim_t)batch_files)
+            {
+                batch_files = fit > 1 ? (int)fit : 1;
+            }
+        }
+    }
+
     pthread_t manager_thread;
     pthread_t *worker_threads = malloc(num_workers * sizeof(pthread_t));
     if (worker_threads == NULL)
@@ -85,16 +177,22 @@ int main(int argc, char *argv[])
     manager_args.source_dir = source_dir;
     manager_args.dest_dir = dest_dir;
     manager_args.stats = &stats;
+    manager_args.scanners = scanners;
+    manager_args.batch_files = batch_files;
 
     pthread_barrier_init(&barrier, NULL, num_workers);
 
-    clock_t start = clock();
+    // Wall time, clock() would add up the CPU time of every thread
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     pthread_create(&manager_thread, NULL, manager_function, (void *)&manager_args);
 
     WorkerThreadArgs worker_args;
     worker_args.buffer = &buffer;
     worker_args.stats = &stats;
+    worker_args.engine = engine;
+    worker_args.uring_depth = uring_depth;
 
     for (int i = 0; i < num_workers; i++)
     {
@@ -110,8 +208,9 @@ int main(int argc, char *argv[])
         pthread_join(worker_threads[i], NULL);
     }
 
-    clock_t end = clock();
-    double elapsed_time = (double)(end - start) / CLOCKS_PER_SEC;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
 
     buffer_destroy(&buffer);
     free(worker_threads);
@@ -127,5 +226,11 @@ int main(int argc, char *argv[])
 
 void print_usage()
 {
-    printf("Usage: MWCp <buffer_size> <num_workers> <source_dir> <dest_dir>\n");
+    printf("Usage: MWCp [-e engine] [-q depth] [-s scanners] [-b files] <buffer_size> <num_workers> <source_dir> <dest_dir>\n");
+    printf("  -e engine  auto (default) tries reflink, copy_file_range, sendfile, then rw\n");
+    printf("             uring keeps up to -q files in flight per worker through io_uring\n");
+    printf("  -q depth   files in flight per uring worker (default %d)\n", URING_DEPTH);
+    printf("  -s scanners  threads walking the source tree (default %d)\n", DEFAULT_SCANNERS);
+    printf("  -b files   small files per buffer item, 1 turns batching off (default %d)\n", DEFAULT_BATCH_FILES);
+    printf("             batches are copied with rw, reflink, copy_file_range and sendfile turn them off\n");
 }
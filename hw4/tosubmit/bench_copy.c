@@ -0,0 +1,278 @@
+// bench_copy.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "copy.h"
+#include "uring.h"
+
+// Copies the same trees with every engine on one thread and prints MB/s.
+// Files stay in the page cache between runs, so this measures syscall and
+// user-space copy overhead rather than the disk. With cold the page cache is
+// dropped before every run, which needs root, otherwise the source files are
+// only advised out of it.
+
+typedef struct
+{
+    const char *name;
+    int files;
+    long min_size;
+    long max_size;
+} Distribution;
+
+static Distribution distributions[] = {
+    {"small_4k", 2000, 4096, 4096},
+    {"mixed_4k_1m", 400, 4096, 1024 * 1024},
+    {"large_64m", 4, 64L * 1024 * 1024, 64L * 1024 * 1024},
+};
+
+typedef struct
+{
+    const char *name;
+    int engine;
+    size_t buffer_size;
+    int depth; // files in flight for the uring engine
+} EngineRun;
+
+// rw_4k is the old worker loop with its 4 KB stack buffer
+static EngineRun runs[] = {
+    {"rw_4k", COPY_ENGINE_READ_WRITE, 4096, 0},
+    {"rw", COPY_ENGINE_READ_WRITE, COPY_BUFFER_SIZE, 0},
+    {"sendfile", COPY_ENGINE_SENDFILE, COPY_BUFFER_SIZE, 0},
+    {"copy_file_range", COPY_ENGINE_COPY_FILE_RANGE, COPY_BUFFER_SIZE, 0},
+    {"reflink", COPY_ENGINE_REFLINK, COPY_BUFFER_SIZE, 0},
+    {"auto", COPY_ENGINE_AUTO, COPY_BUFFER_SIZE, 0},
+    {"uring_q4", COPY_ENGINE_URING, URING_CHUNK_SIZE, 4},
+    {"uring_q32", COPY_ENGINE_URING, URING_CHUNK_SIZE, 32},
+};
+
+static double now_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void file_path(char *path, const char *dir, const char *side, int index)
+{
+    snprintf(path, PATH_MAX, "%s/%s_%d", dir, side, index);
+}
+
+// Sizes are log-uniform between min and max, so every order of magnitude gets as many files
+static long long create_files(const char *dir, Distribution *distribution, const char *block, size_t block_size)
+{
+    long long total = 0;
+    for (int i = 0; i < distribution->files; i++)
+    {
+        double span = log((double)distribution->max_size / distribution->min_size);
+        long size = (long)(distribution->min_size * exp(span * drand48()));
+
+        char path[PATH_MAX];
+        file_path(path, dir, "source", i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            perror("Failed to create source file");
+            exit(EXIT_FAILURE);
+        }
+        for (long left = size; left > 0;)
+        {
+            ssize_t bytes = write(fd, block, left < (long)block_size ? left : (long)block_size);
+            if (bytes < 0)
+            {
+                perror("Failed to write source file");
+                exit(EXIT_FAILURE);
+            }
+            left -= bytes;
+        }
+        close(fd);
+        total += size;
+    }
+    return total;
+}
+
+static void remove_files(const char *dir, const char *side, int files)
+{
+    for (int i = 0; i < files; i++)
+    {
+        char path[PATH_MAX];
+        file_path(path, dir, side, i);
+        unlink(path);
+    }
+}
+
+static void drop_cache(const char *dir, int files)
+{
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd >= 0 && write(fd, "3", 1) == 1)
+    {
+        close(fd);
+        return;
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    for (int i = 0; i < files; i++)
+    {
+        char path[PATH_MAX];
+        file_path(path, dir, "source", i);
+        int source_fd = open(path, O_RDONLY);
+        posix_fadvise(source_fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(source_fd);
+    }
+}
+
+static long long copy_files_with_uring(const char *dir, Distribution *distribution, EngineRun *run, int *failed)
+{
+    UringCopier copier;
+    if (uring_copier_init(&copier, run->depth, run->buffer_size) < 0)
+    {
+        *failed = 1;
+        return 0;
+    }
+    UringDone *done = malloc(run->depth * sizeof(UringDone));
+
+    long long copied = 0;
+    int next = 0;
+    while (!*failed && (next < distribution->files || copier.in_flight > 0))
+    {
+        while (next < distribution->files && copier.in_flight < copier.depth)
+        {
+            char source_path[PATH_MAX];
+            char dest_path[PATH_MAX];
+            file_path(source_path, dir, "source", next);
+            file_path(dest_path, dir, "dest", next);
+            Transaction transaction = {open(source_path, O_RDONLY), open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)};
+            uring_copier_add(&copier, &transaction);
+            next++;
+        }
+
+        int finished = uring_copier_complete(&copier, done, copier.depth);
+        *failed = finished < 0;
+        for (int i = 0; i < finished; i++)
+        {
+            *failed |= done[i].error != 0;
+            copied += done[i].copied;
+            close(done[i].transaction.source_fd);
+            close(done[i].transaction.dest_fd);
+        }
+    }
+
+    free(done);
+    uring_copier_destroy(&copier);
+    return copied;
+}
+
+// Returns MB/s, or -1 when the engine cannot copy these files
+static double copy_files(const char *dir, Distribution *distribution, EngineRun *run, long long total, int cold)
+{
+    if (cold)
+    {
+        drop_cache(dir, distribution->files);
+    }
+    if (run->engine == COPY_ENGINE_URING)
+    {
+        int failed = 0;
+        double start = now_seconds();
+        long long copied = copy_files_with_uring(dir, distribution, run, &failed);
+        double elapsed = now_seconds() - start;
+        remove_files(dir, "dest", distribution->files);
+        return failed || copied != total ? -1 : total / (1024.0 * 1024.0) / elapsed;
+    }
+
+    CopyContext copy;
+    if (copy_context_init(&copy, run->engine, run->buffer_size) < 0)
+    {
+        perror("Failed to allocate copy buffer");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now_seconds();
+    long long copied = 0;
+    int failed = 0;
+    for (int i = 0; i < distribution->files && !failed; i++)
+    {
+        char source_path[PATH_MAX];
+        char dest_path[PATH_MAX];
+        file_path(source_path, dir, "source", i);
+        file_path(dest_path, dir, "dest", i);
+        int source_fd = open(source_path, O_RDONLY);
+        int dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ssize_t bytes = source_fd < 0 || dest_fd < 0 ? -1 : copy_file(&copy, source_fd, dest_fd);
+        if (bytes < 0)
+        {
+            failed = 1;
+        }
+        else
+        {
+            copied += bytes;
+        }
+        close(source_fd);
+        close(dest_fd);
+    }
+    double elapsed = now_seconds() - start;
+
+    copy_context_destroy(&copy);
+    remove_files(dir, "dest", distribution->files);
+    if (failed || copied != total)
+    {
+        return -1;
+    }
+    return total / (1024.0 * 1024.0) / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = argc > 1 ? argv[1] : ".";
+    int repeats = argc > 2 ? atoi(argv[2]) : 3;
+    int cold = argc > 3 && strcmp(argv[3], "cold") == 0;
+
+    char block[64 * 1024];
+    for (size_t i = 0; i < sizeof(block); i++)
+    {
+        block[i] = (char)(i * 31 + 7);
+    }
+    srand48(1);
+
+    printf("distribution,files,mb,engine,mb_per_s\n");
+    for (int d = 0; d < (int)(sizeof(distributions) / sizeof(distributions[0])); d++)
+    {
+        Distribution *distribution = &distributions[d];
+        long long total = create_files(dir, distribution, block, sizeof(block));
+
+        for (int r = 0; r < (int)(sizeof(runs) / sizeof(runs[0])); r++)
+        {
+            // Best of the repeats, the first one may still be warming the cache
+            double best = -1;
+            for (int i = 0; i < repeats; i++)
+            {
+                double rate = copy_files(dir, distribution, &runs[r], total, cold);
+                if (rate > best)
+                {
+                    best = rate;
+                }
+            }
+            if (best < 0)
+            {
+                printf("%s,%d,%.1f,%s,n/a\n", distribution->name, distribution->files, total / (1024.0 * 1024.0), runs[r].name);
+            }
+            else
+            {
+                printf("%s,%d,%.1f,%s,%.0f\n", distribution->name, distribution->files, total / (1024.0 * 1024.0), runs[r].name, best);
+            }
+            fflush(stdout);
+        }
+
+        remove_files(dir, "source", distribution->files);
+    }
+
+    return 0;
+}
@@ -55,8 +55,7 @@ void buffer_put(Buffer *buffer, const Transaction *item)
         }
         pthread_cond_wait(&buffer->not_full, &buffer->mutex);
     }
-    buffer->data[buffer->tail].dest_fd = item->dest_fd;
-    buffer->data[buffer->tail].source_fd = item->source_fd;
+    buffer->data[buffer->tail] = *item;
     buffer->tail = (buffer->tail + 1) % buffer->size;
     buffer->count++;
     pthread_cond_signal(&buffer->not_empty);
@@ -82,3 +81,22 @@ Transaction buffer_get(Buffer *buffer)
     pthread_mutex_unlock(&buffer->mutex);
     return item;
 }
+
+// Returns 1 with an item, 0 when the buffer is empty for now and -1 once it is
+// empty and closed, without waiting
+int buffer_try_get(Buffer *buffer, Transaction *item)
+{
+    pthread_mutex_lock(&buffer->mutex);
+    if (buffer->count == 0)
+    {
+        int finished = stop || buffer->closed;
+        pthread_mutex_unlock(&buffer->mutex);
+        return finished ? -1 : 0;
+    }
+    *item = buffer->data[buffer->head];
+    buffer->head = (buffer->head + 1) % buffer->size;
+    buffer->count--;
+    pthread_cond_signal(&buffer->not_full);
+    pthread_mutex_unlock(&buffer->mutex);
+    return 1;
+}
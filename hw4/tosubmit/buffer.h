@@ -23,5 +23,6 @@ void buffer_destroy(Buffer *buffer);
 void buffer_close(Buffer *buffer);
 void buffer_put(Buffer *buffer, const Transaction *item);
 Transaction buffer_get(Buffer *buffer);
+int buffer_try_get(Buffer *buffer, Transaction *item);
 
 #endif // BUFFER_H
@@ -0,0 +1,310 @@
+// copy.c
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include "copy.h"
+
+// Largest request handed to the kernel at once, it may copy less
+#define COPY_CHUNK (1L << 30)
+
+static const char *engine_names[COPY_ENGINE_COUNT] = {"auto", "reflink", "copy_file_range", "sendfile", "rw", "uring"};
+
+// Errors that mean an engine cannot copy between these files, not that the copy failed
+static int is_unsupported(int error)
+{
+    return error == EOPNOTSUPP || error == ENOSYS || error == EXDEV || error == EINVAL || error == ENOTTY;
+}
+
+// Shares the source extents with the destination, only some filesystems can.
+// FICLONE ignores the offsets and clones the whole file, so it only stands in
+// for a copy that starts at the beginning of both files.
+static int copy_with_reflink(CopyContext *context, int source_fd, int dest_fd, off_t *copied)
+{
+    if (lseek(source_fd, 0, SEEK_CUR) != 0 || lseek(dest_fd, 0, SEEK_CUR) != 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    struct stat source_stat;
+    if (fstat(source_fd, &source_stat) < 0 || ioctl(dest_fd, FICLONE, source_fd) < 0)
+    {
+        return -1;
+    }
+    *copied = source_stat.st_size;
+    return 0;
+}
+
+static int copy_with_copy_file_range(CopyContext *context, int source_fd, int dest_fd, off_t *copied)
+{
+    while (1)
+    {
+        ssize_t bytes = copy_file_range(source_fd, NULL, dest_fd, NULL, COPY_CHUNK, 0);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes == 0)
+        {
+            return 0;
+        }
+        *copied += bytes;
+    }
+}
+
+static int copy_with_sendfile(CopyContext *context, int source_fd, int dest_fd, off_t *copied)
+{
+    while (1)
+    {
+        ssize_t bytes = sendfile(dest_fd, source_fd, NULL, COPY_CHUNK);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes == 0)
+        {
+            return 0;
+        }
+        *copied += bytes;
+    }
+}
+
+static int copy_with_read_write(CopyContext *context, int source_fd, int dest_fd, off_t *copied)
+{
+    while (1)
+    {
+        ssize_t bytes_read = read(source_fd, context->buffer, context->buffer_size);
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0)
+        {
+            return 0;
+        }
+
+        ssize_t written = 0;
+        while (written < bytes_read)
+        {
+            ssize_t bytes = write(dest_fd, context->buffer + written, bytes_read - written);
+            if (bytes < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return -1;
+            }
+            written += bytes;
+        }
+        *copied += bytes_read;
+    }
+}
+
+// Ranges leave the file offsets alone, so workers can copy chunks of one file at once
+
+static int range_with_reflink(CopyContext *context, int source_fd, int dest_fd, off_t offset, off_t length, off_t *copied)
+{
+    struct file_clone_range range = {source_fd, offset, length, offset};
+    if (ioctl(dest_fd, FICLONERANGE, &range) < 0)
+    {
+        return -1;
+    }
+    *copied = length;
+    return 0;
+}
+
+static int range_with_copy_file_range(CopyContext *context, int source_fd, int dest_fd, off_t offset, off_t length, off_t *copied)
+{
+    off_t source_offset = offset + *copied;
+    off_t dest_offset = source_offset;
+    while (*copied < length)
+    {
+        ssize_t bytes = copy_file_range(source_fd, &source_offset, dest_fd, &dest_offset, length - *copied, 0);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes == 0)
+        {
+            // The source got shorter since it was split
+            return 0;
+        }
+        *copied += bytes;
+    }
+    return 0;
+}
+
+static int range_with_pread_pwrite(CopyContext *context, int source_fd, int dest_fd, off_t offset, off_t length, off_t *copied)
+{
+    while (*copied < length)
+    {
+        size_t wanted = length - *copied < (off_t)context->buffer_size ? length - *copied : context->buffer_size;
+        ssize_t bytes_read = pread(source_fd, context->buffer, wanted, offset + *copied);
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0)
+        {
+            return 0;
+        }
+
+        ssize_t written = 0;
+        while (written < bytes_read)
+        {
+            ssize_t bytes = pwrite(dest_fd, context->buffer + written, bytes_read - written, offset + *copied + written);
+            if (bytes < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return -1;
+            }
+            written += bytes;
+        }
+        *copied += bytes_read;
+    }
+    return 0;
+}
+
+// sendfile writes at the shared offset of the destination, its ranges go through pread and pwrite
+static int (*const range_engines[COPY_ENGINE_COUNT])(CopyContext *, int, int, off_t, off_t, off_t *) = {
+    NULL,
+    range_with_reflink,
+    range_with_copy_file_range,
+    NULL,
+    range_with_pread_pwrite,
+    NULL,
+};
+
+static int (*const copy_engines[COPY_ENGINE_COUNT])(CopyContext *, int, int, off_t *) = {
+    NULL,
+    copy_with_reflink,
+    copy_with_copy_file_range,
+    copy_with_sendfile,
+    copy_with_read_write,
+    NULL,
+};
+
+int copy_engine_from_name(const char *name)
+{
+    for (int i = 0; i < COPY_ENGINE_COUNT; i++)
+    {
+        if (strcmp(name, engine_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *copy_engine_name(int engine)
+{
+    return engine >= 0 && engine < COPY_ENGINE_COUNT ? engine_names[engine] : "unknown";
+}
+
+int copy_context_init(CopyContext *context, int engine, size_t buffer_size)
+{
+    context->engine = engine;
+    context->buffer_size = buffer_size;
+    context->last_engine = -1;
+    context->buffer = malloc(buffer_size);
+    return context->buffer == NULL ? -1 : 0;
+}
+
+void copy_context_destroy(CopyContext *context)
+{
+    free(context->buffer);
+    context->buffer = NULL;
+}
+
+// Copies from the current offsets to the end of the source and returns the
+// bytes copied, or -1 with errno set. The streaming engines move the file
+// offsets as they go, so the next engine picks up where an unsupported one
+// stopped. Reflink leaves them alone and is skipped unless both are at 0.
+// The uring engine copies single files like auto, when io_uring is missing.
+ssize_t copy_file(CopyContext *context, int source_fd, int dest_fd)
+{
+    int automatic = context->engine == COPY_ENGINE_AUTO || context->engine == COPY_ENGINE_URING;
+    int first = automatic ? COPY_ENGINE_REFLINK : context->engine;
+    int last = automatic ? COPY_ENGINE_READ_WRITE : context->engine;
+    off_t copied = 0;
+    for (int engine = first; engine <= last; engine++)
+    {
+        if (copy_engines[engine](context, source_fd, dest_fd, &copied) == 0)
+        {
+            context->last_engine = engine;
+            return copied;
+        }
+        if (!is_unsupported(errno))
+        {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// Copies length bytes at offset to the same offset of the destination and
+// returns the bytes copied, or -1 with errno set
+ssize_t copy_range(CopyContext *context, int source_fd, int dest_fd, off_t offset, off_t length)
+{
+    int first = context->engine;
+    int last = context->engine;
+    if (context->engine == COPY_ENGINE_AUTO || context->engine == COPY_ENGINE_URING)
+    {
+        first = COPY_ENGINE_REFLINK;
+        last = COPY_ENGINE_READ_WRITE;
+    }
+    else if (context->engine == COPY_ENGINE_SENDFILE)
+    {
+        first = COPY_ENGINE_READ_WRITE;
+        last = COPY_ENGINE_READ_WRITE;
+    }
+
+    off_t copied = 0;
+    for (int engine = first; engine <= last; engine++)
+    {
+        if (range_engines[engine] == NULL)
+        {
+            continue;
+        }
+        if (range_engines[engine](context, source_fd, dest_fd, offset, length, &copied) == 0)
+        {
+            context->last_engine = engine;
+            return copied;
+        }
+        if (!is_unsupported(errno))
+        {
+            return -1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,35 @@
+// copy.h
+#ifndef COPY_H
+#define COPY_H
+
+#include <sys/types.h>
+
+// Large-buffer loop used when the kernel cannot copy between the files itself
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+// auto tries reflink, then copy_file_range, then sendfile, then read/write
+#define COPY_ENGINE_AUTO 0
+#define COPY_ENGINE_REFLINK 1
+#define COPY_ENGINE_COPY_FILE_RANGE 2
+#define COPY_ENGINE_SENDFILE 3
+#define COPY_ENGINE_READ_WRITE 4
+// Workers keep many files in flight through io_uring instead of calling copy_file
+#define COPY_ENGINE_URING 5
+#define COPY_ENGINE_COUNT 6
+
+typedef struct
+{
+    int engine;
+    char *buffer;
+    size_t buffer_size;
+    int last_engine; // engine that finished the last copy_file
+} CopyContext;
+
+int copy_engine_from_name(const char *name);
+const char *copy_engine_name(int engine);
+int copy_context_init(CopyContext *context, int engine, size_t buffer_size);
+void copy_context_destroy(CopyContext *context);
+ssize_t copy_file(CopyContext *context, int source_fd, int dest_fd);
+ssize_t copy_range(CopyContext *context, int source_fd, int dest_fd, off_t offset, off_t length);
+
+#endif // COPY_H
@@ -0,0 +1,91 @@
+// dir_queue.c
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include "dir_queue.h"
+
+extern volatile sig_atomic_t stop;
+
+void dir_queue_init(DirQueue *queue)
+{
+    queue->paths = NULL;
+    queue->count = 0;
+    queue->capacity = 0;
+    queue->busy = 0;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+}
+
+void dir_queue_destroy(DirQueue *queue)
+{
+    for (int i = 0; i < queue->count; i++)
+    {
+        free(queue->paths[i]);
+    }
+    free(queue->paths);
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->changed);
+}
+
+int dir_queue_push(DirQueue *queue, const char *path)
+{
+    char *copy = strdup(path);
+    if (copy == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->count == queue->capacity)
+    {
+        int capacity = queue->capacity == 0 ? 64 : 2 * queue->capacity;
+        char **paths = realloc(queue->paths, capacity * sizeof(char *));
+        if (paths == NULL)
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            free(copy);
+            return -1;
+        }
+        queue->paths = paths;
+        queue->capacity = capacity;
+    }
+    queue->paths[queue->count++] = copy;
+    pthread_cond_signal(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return 0;
+}
+
+// Takes the most recently found directory, so the walk stays mostly depth
+// first and the queue short. Returns NULL once the queue is empty and no
+// scanner can add to it anymore, or on stop.
+char *dir_queue_pop(DirQueue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0 && queue->busy > 0 && !stop)
+    {
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+    }
+    if (queue->count == 0 || stop)
+    {
+        pthread_mutex_unlock(&queue->mutex);
+        return NULL;
+    }
+    char *path = queue->paths[--queue->count];
+    queue->busy++;
+    pthread_mutex_unlock(&queue->mutex);
+    return path;
+}
+
+// Marks a popped directory as scanned, the last one wakes the idle scanners to finish
+void dir_queue_done(DirQueue *queue, char *path)
+{
+    free(path);
+    pthread_mutex_lock(&queue->mutex);
+    queue->busy--;
+    if ((queue->busy == 0 && queue->count == 0) || stop)
+    {
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+}
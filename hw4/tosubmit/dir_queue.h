@@ -0,0 +1,26 @@
+// dir_queue.h
+#ifndef DIR_QUEUE_H
+#define DIR_QUEUE_H
+
+#include <pthread.h>
+
+// Directories found but not scanned yet, as paths relative to the source and
+// destination roots. Paths instead of open descriptors keep a wide tree from
+// running out of them.
+typedef struct
+{
+    char **paths;
+    int count;
+    int capacity;
+    int busy; // scanners in the middle of a directory, each may still push more
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+} DirQueue;
+
+void dir_queue_init(DirQueue *queue);
+void dir_queue_destroy(DirQueue *queue);
+int dir_queue_push(DirQueue *queue, const char *path);
+char *dir_queue_pop(DirQueue *queue);
+void dir_queue_done(DirQueue *queue, char *path);
+
+#endif // DIR_QUEUE_H
@@ -1,4 +1,5 @@
 // manager.c
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <dirent.h>
@@ -9,87 +10,347 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/syscall.h>
 #include "buffer.h"
 #include "transaction.h"
 #include "thread_args.h"
+#include "dir_queue.h"
 
 extern volatile sig_atomic_t stop;
 
-void *manager_function(void *arg)
+// Room for a few hundred entries per getdents64 call
+#define SCAN_BUFFER_SIZE (32 * 1024)
+
+// What the kernel writes for each entry, declared here since older C libraries do not
+struct linux_dirent64
 {
-    ManagerThreadArgs *args = (ManagerThreadArgs *)arg;
-    Buffer *buffer = args->buffer;
-    char *source_dir = args->source_dir;
-    char *dest_dir = args->dest_dir;
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
 
-    DIR *dir = opendir(source_dir);
-    if (dir == NULL)
+// Shared by the scanners of one copy
+typedef struct
+{
+    Buffer *buffer;
+    Stats *stats;
+    DirQueue *queue;
+    int source_root;
+    int dest_root;
+    int batch_files;
+} ScanContext;
+
+// One scanner thread, it fills its own batch of small files
+typedef struct
+{
+    ScanContext *context;
+    TransactionBatch *batch;
+} Scanner;
+
+static void flush_batch(Scanner *scanner)
+{
+    if (scanner->batch == NULL || scanner->batch->count == 0)
     {
-        perror("Failed to open source directory");
-        return NULL;
+        return;
     }
+    Transaction transaction;
+    transaction_init_batch(&transaction, scanner->batch);
+    buffer_put(scanner->context->buffer, &transaction);
+    scanner->batch = NULL;
+}
 
-    struct dirent *entry;
-    while (!stop && (entry = readdir(dir)) != NULL)
+// Returns 0 when the file joined the batch, -1 when it has to go alone
+static int batch_file(Scanner *scanner, int src_fd, int dest_fd, off_t size)
+{
+    if (scanner->context->batch_files <= 1 || size > TRANSACTION_SMALL_FILE_SIZE)
+    {
+        return -1;
+    }
+    if (scanner->batch != NULL && scanner->batch->bytes + size > TRANSACTION_BATCH_BYTES)
+    {
+        flush_batch(scanner);
+    }
+    if (scanner->batch == NULL && (scanner->batch = transaction_batch_create()) == NULL)
+    {
+        return -1;
+    }
+
+    BatchFile *file = &scanner->batch->files[scanner->batch->count++];
+    file->source_fd = src_fd;
+    file->dest_fd = dest_fd;
+    file->size = size;
+    scanner->batch->bytes += size;
+    if (scanner->batch->count == scanner->context->batch_files)
+    {
+        flush_batch(scanner);
+    }
+    return 0;
+}
+
+// Small files wait in the scanner's batch. Large files go out as chunks so
+// several workers copy them at once, the destination gets its full size
+// first, then chunks can land in any order.
+static void put_file(Scanner *scanner, int src_fd, int dest_fd)
+{
+    Buffer *buffer = scanner->context->buffer;
+    Transaction transaction;
+    transaction_init(&transaction, src_fd, dest_fd);
+
+    struct stat src_stat;
+    if (fstat(src_fd, &src_stat) < 0)
+    {
+        buffer_put(buffer, &transaction);
+        return;
+    }
+    if (batch_file(scanner, src_fd, dest_fd, src_stat.st_size) == 0)
+    {
+        return;
+    }
+    if (src_stat.st_size <= TRANSACTION_CHUNK_SIZE)
+    {
+        buffer_put(buffer, &transaction);
+        return;
+    }
+
+    if (fallocate(dest_fd, 0, 0, src_stat.st_size) < 0 && ftruncate(dest_fd, src_stat.st_size) < 0)
+    {
+        buffer_put(buffer, &transaction);
+        return;
+    }
+
+    int chunks = (src_stat.st_size + TRANSACTION_CHUNK_SIZE - 1) / TRANSACTION_CHUNK_SIZE;
+    SplitFile *file = split_file_create(src_fd, dest_fd, chunks);
+    if (file == NULL)
     {
-        if (entry->d_type == DT_REG)
+        buffer_put(buffer, &transaction);
+        return;
+    }
+
+    for (int i = 0; i < chunks; i++)
+    {
+        transaction.offset = (off_t)i * TRANSACTION_CHUNK_SIZE;
+        transaction.length = src_stat.st_size - transaction.offset;
+        if (transaction.length > TRANSACTION_CHUNK_SIZE)
         {
-            char src_path[PATH_MAX];
-            char dest_path[PATH_MAX];
-            snprintf(src_path, PATH_MAX, "%s/%s", source_dir, entry->d_name);
-            snprintf(dest_path, PATH_MAX, "%s/%s", dest_dir, entry->d_name);
+            transaction.length = TRANSACTION_CHUNK_SIZE;
+        }
+        transaction.file = file;
+        buffer_put(buffer, &transaction);
+    }
+}
 
-            int src_fd = open(src_path, O_RDONLY);
-            if (src_fd < 0)
-            {
-                perror("Failed to open source file");
-                continue;
-            }
+// Files are opened relative to their directory, so the kernel never walks
+// the full path again. Subdirectories are created here and queued for any
+// scanner.
+static void scan_entry(Scanner *scanner, int src_dir_fd, int dest_dir_fd, const char *dir_path, const char *name, unsigned char type)
+{
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    {
+        return;
+    }
 
-            int dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (dest_fd < 0)
-            {
-                perror("Failed to open/create destination file");
-                close(src_fd);
-                continue;
-            }
+    ScanContext *context = scanner->context;
+    if (type == DT_UNKNOWN)
+    {
+        struct stat entry_stat;
+        if (fstatat(src_dir_fd, name, &entry_stat, AT_SYMLINK_NOFOLLOW) < 0)
+        {
+            perror("Failed to stat source entry");
+            return;
+        }
+        type = S_ISREG(entry_stat.st_mode) ? DT_REG : S_ISDIR(entry_stat.st_mode) ? DT_DIR : DT_UNKNOWN;
+    }
+
+    if (type == DT_REG)
+    {
+        int src_fd = openat(src_dir_fd, name, O_RDONLY);
+        if (src_fd < 0)
+        {
+            perror("Failed to open source file");
+            return;
+        }
+
+        int dest_fd = openat(dest_dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (dest_fd < 0)
+        {
+            perror("Failed to open/create destination file");
+            close(src_fd);
+            return;
+        }
 
-            Transaction transaction = {src_fd, dest_fd};
-            buffer_put(buffer, &transaction);
+        put_file(scanner, src_fd, dest_fd);
+    }
+    else if (type == DT_DIR)
+    {
+        char path[PATH_MAX];
+        if (snprintf(path, PATH_MAX, "%s/%s", dir_path, name) >= PATH_MAX)
+        {
+            fprintf(stderr, "Path too long: %s/%s\n", dir_path, name);
+            return;
         }
-        else if (entry->d_type == DT_DIR)
+
+        if (mkdirat(dest_dir_fd, name, 0755) < 0)
         {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            if (errno != EEXIST)
             {
-                continue;
+                perror("Failed to create destination directory");
+                return;
             }
+        }
 
-            char src_path[PATH_MAX];
-            char dest_path[PATH_MAX];
-            snprintf(src_path, PATH_MAX, "%s/%s", source_dir, entry->d_name);
-            snprintf(dest_path, PATH_MAX, "%s/%s", dest_dir, entry->d_name);
+        stats_increment_directories(context->stats);
 
-            if (mkdir(dest_path, 0755) < 0)
+        if (dir_queue_push(context->queue, path) < 0)
+        {
+            perror("Failed to queue directory");
+        }
+    }
+}
+
+// Reads the directory in large batches, returns -1 when getdents64 is not there
+static int scan_with_getdents(Scanner *scanner, int src_dir_fd, int dest_dir_fd, const char *dir_path)
+{
+    char entries[SCAN_BUFFER_SIZE];
+    while (!stop)
+    {
+        long bytes = syscall(SYS_getdents64, src_dir_fd, entries, sizeof(entries));
+        if (bytes < 0)
+        {
+            if (errno == ENOSYS)
             {
-                if (errno != EEXIST)
-                {
-                    perror("Failed to create destination directory");
-                    continue;
-                }
+                return -1;
             }
+            perror("Failed to read source directory");
+            return 0;
+        }
+        if (bytes == 0)
+        {
+            return 0;
+        }
 
-            stats_increment_directories(args->stats);
-
-            ManagerThreadArgs new_args;
-            new_args.buffer = buffer;
-            new_args.source_dir = src_path;
-            new_args.dest_dir = dest_path;
-            new_args.stats = args->stats;
+        for (long position = 0; position < bytes && !stop;)
+        {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(entries + position);
+            scan_entry(scanner, src_dir_fd, dest_dir_fd, dir_path, entry->d_name, entry->d_type);
+            position += entry->d_reclen;
+        }
+    }
+    return 0;
+}
 
-            manager_function(&new_args);
+static void scan_with_readdir(Scanner *scanner, int src_dir_fd, int dest_dir_fd, const char *dir_path)
+{
+    // closedir closes the descriptor it was given, the caller still closes its own
+    int fd = dup(src_dir_fd);
+    DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+    if (dir == NULL)
+    {
+        perror("Failed to open source directory");
+        if (fd >= 0)
+        {
+            close(fd);
         }
+        return;
     }
 
+    struct dirent *entry;
+    while (!stop && (entry = readdir(dir)) != NULL)
+    {
+        scan_entry(scanner, src_dir_fd, dest_dir_fd, dir_path, entry->d_name, entry->d_type);
+    }
     closedir(dir);
+}
+
+static void *scanner_function(void *arg)
+{
+    Scanner scanner = {(ScanContext *)arg, NULL};
+    ScanContext *context = scanner.context;
+    char *path;
+    while ((path = dir_queue_pop(context->queue)) != NULL)
+    {
+        int src_dir_fd = openat(context->source_root, path, O_RDONLY | O_DIRECTORY);
+        int dest_dir_fd = openat(context->dest_root, path, O_RDONLY | O_DIRECTORY);
+        if (src_dir_fd < 0 || dest_dir_fd < 0)
+        {
+            perror("Failed to open directory");
+        }
+        else if (scan_with_getdents(&scanner, src_dir_fd, dest_dir_fd, path) < 0)
+        {
+            scan_with_readdir(&scanner, src_dir_fd, dest_dir_fd, path);
+        }
+        // A partial batch would keep its files open while this scanner walks
+        // other directories, so it goes out with the directory it came from
+        flush_batch(&scanner);
+
+        if (src_dir_fd >= 0)
+        {
+            close(src_dir_fd);
+        }
+        if (dest_dir_fd >= 0)
+        {
+            close(dest_dir_fd);
+        }
+        dir_queue_done(context->queue, path);
+    }
+    free(scanner.batch);
+    return NULL;
+}
+
+// Walks the source tree with a pool of scanner threads that take directories
+// from a shared queue and feed the copy buffer as they go
+void *manager_function(void *arg)
+{
+    ManagerThreadArgs *args = (ManagerThreadArgs *)arg;
+
+    ScanContext context;
+    context.buffer = args->buffer;
+    context.stats = args->stats;
+    context.batch_files = args->batch_files;
+    context.source_root = open(args->source_dir, O_RDONLY | O_DIRECTORY);
+    if (context.source_root < 0)
+    {
+        perror("Failed to open source directory");
+        return NULL;
+    }
+    context.dest_root = open(args->dest_dir, O_RDONLY | O_DIRECTORY);
+    if (context.dest_root < 0)
+    {
+        perror("Failed to open destination directory");
+        close(context.source_root);
+        return NULL;
+    }
+
+    DirQueue queue;
+    dir_queue_init(&queue);
+    context.queue = &queue;
+    if (dir_queue_push(&queue, ".") < 0)
+    {
+        perror("Failed to queue directory");
+    }
+
+    pthread_t *scanners = malloc(args->scanners * sizeof(pthread_t));
+    int started = 0;
+    while (scanners != NULL && started < args->scanners && pthread_create(&scanners[started], NULL, scanner_function, &context) == 0)
+    {
+        started++;
+    }
+    if (started == 0)
+    {
+        // Scan on this thread rather than not at all
+        scanner_function(&context);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(scanners[i], NULL);
+    }
+
+    free(scanners);
+    dir_queue_destroy(&queue);
+    close(context.source_root);
+    close(context.dest_root);
     return NULL;
 }
@@ -9,6 +9,11 @@ void stats_init(Stats *stats)
     stats->regular_files = 0;
     stats->directories = 0;
     stats->bytes = 0;
+    stats->batched_files = 0;
+    for (int i = 0; i < COPY_ENGINE_COUNT; i++)
+    {
+        stats->engine_files[i] = 0;
+    }
     pthread_mutex_init(&stats->mutex, NULL);
 }
 
@@ -17,7 +22,22 @@ void stats_print(Stats *stats)
     printf("Execution time: %.6f seconds\n", stats->execution_time);
     printf("Regular files: %d\n", stats->regular_files);
     printf("Directories: %d\n", stats->directories);
-    printf("Bytes: %d\n", stats->bytes);
+    printf("Bytes: %lld\n", stats->bytes);
+    if (stats->execution_time > 0)
+    {
+        printf("Files per second: %.0f\n", stats->regular_files / stats->execution_time);
+    }
+    if (stats->batched_files > 0)
+    {
+        printf("Files copied in batches: %d\n", stats->batched_files);
+    }
+    for (int i = 0; i < COPY_ENGINE_COUNT; i++)
+    {
+        if (stats->engine_files[i] > 0)
+        {
+            printf("Files copied with %s: %d\n", copy_engine_name(i), stats->engine_files[i]);
+        }
+    }
 }
 
 void stats_increment_regular_files(Stats *stats)
@@ -34,9 +54,31 @@ void stats_increment_directories(Stats *stats)
     pthread_mutex_unlock(&stats->mutex);
 }
 
-void stats_increment_bytes(Stats *stats, int bytes)
+void stats_increment_bytes(Stats *stats, long long bytes)
 {
     pthread_mutex_lock(&stats->mutex);
     stats->bytes += bytes;
     pthread_mutex_unlock(&stats->mutex);
 }
+
+void stats_increment_engine(Stats *stats, int engine)
+{
+    pthread_mutex_lock(&stats->mutex);
+    stats->engine_files[engine]++;
+    pthread_mutex_unlock(&stats->mutex);
+}
+
+// One lock for a whole batch instead of three per file
+// engine_files holds COPY_ENGINE_COUNT counts of the batch's files that were copied
+void stats_add_batch(Stats *stats, int files, long long bytes, const int *engine_files)
+{
+    pthread_mutex_lock(&stats->mutex);
+    stats->regular_files += files;
+    stats->batched_files += files;
+    stats->bytes += bytes;
+    for (int i = 0; i < COPY_ENGINE_COUNT; i++)
+    {
+        stats->engine_files[i] += engine_files[i];
+    }
+    pthread_mutex_unlock(&stats->mutex);
+}
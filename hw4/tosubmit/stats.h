@@ -3,13 +3,16 @@
 #define STATS_H
 
 #include <pthread.h>
+#include "copy.h"
 
 typedef struct
 {
     double execution_time;
     int regular_files;
     int directories;
-    int bytes;
+    long long bytes;
+    int batched_files; // small files copied in batches, also in regular_files
+    int engine_files[COPY_ENGINE_COUNT]; // files finished by each copy engine
     pthread_mutex_t mutex;
 } Stats;
 
@@ -17,6 +20,8 @@ void stats_init(Stats *stats);
 void stats_print(Stats *stats);
 void stats_increment_regular_files(Stats *stats);
 void stats_increment_directories(Stats *stats);
-void stats_increment_bytes(Stats *stats, int bytes);
+void stats_increment_bytes(Stats *stats, long long bytes);
+void stats_increment_engine(Stats *stats, int engine);
+void stats_add_batch(Stats *stats, int files, long long bytes, const int *engine_files);
 
 #endif // STATS_H
\ No newline at end of file
@@ -11,12 +11,16 @@ typedef struct
     char *source_dir;
     char *dest_dir;
     Stats *stats;
+    int scanners;    // threads walking the source tree
+    int batch_files; // small files per buffer item, 1 sends every file alone
 } ManagerThreadArgs;
 
 typedef struct
 {
     Buffer *buffer;
     Stats *stats;
+    int engine;
+    int uring_depth;
 } WorkerThreadArgs;
 
 #endif // THREAD_ARGS_H
\ No newline at end of file
@@ -1,8 +1,75 @@
-// transaction.
+// transaction.c
+#include <stdlib.h>
+#include <pthread.h>
 #include "transaction.h"
 
 void transaction_init(Transaction *transaction, int source_fd, int dest_fd)
 {
     transaction->source_fd = source_fd;
     transaction->dest_fd = dest_fd;
-}
\ No newline at end of file
+    transaction->offset = 0;
+    transaction->length = 0;
+    transaction->file = NULL;
+    transaction->batch = NULL;
+}
+
+SplitFile *split_file_create(int source_fd, int dest_fd, int chunks)
+{
+    SplitFile *file = malloc(sizeof(SplitFile));
+    if (file == NULL)
+    {
+        return NULL;
+    }
+    file->source_fd = source_fd;
+    file->dest_fd = dest_fd;
+    file->chunks_left = chunks;
+    file->failed = 0;
+    pthread_mutex_init(&file->mutex, NULL);
+    return file;
+}
+
+// Returns 1 when the whole file is done, the caller then closes its files.
+// For a split file that is the last chunk to finish, which also frees it and
+// sets failed when any chunk of the file failed.
+int transaction_finish(Transaction *transaction, int *failed)
+{
+    SplitFile *file = transaction->file;
+    if (file == NULL)
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&file->mutex);
+    file->failed |= *failed;
+    int last = --file->chunks_left == 0;
+    if (last)
+    {
+        *failed = file->failed;
+    }
+    pthread_mutex_unlock(&file->mutex);
+    if (last)
+    {
+        pthread_mutex_destroy(&file->mutex);
+        free(file);
+    }
+    return last;
+}
+
+TransactionBatch *transaction_batch_create()
+{
+    TransactionBatch *batch = malloc(sizeof(TransactionBatch));
+    if (batch != NULL)
+    {
+        batch->count = 0;
+        batch->bytes = 0;
+    }
+    return batch;
+}
+
+// The batch is freed by the worker that copies it. The transaction takes the
+// first file's descriptors, so it never looks like the end of the buffer.
+void transaction_init_batch(Transaction *transaction, TransactionBatch *batch)
+{
+    transaction_init(transaction, batch->files[0].source_fd, batch->files[0].dest_fd);
+    transaction->batch = batch;
+}
@@ -2,12 +2,58 @@
 #ifndef TRANSACTION_H
 #define TRANSACTION_H
 
+#include <pthread.h>
+#include <sys/types.h>
+
+// Files larger than a chunk are split so every worker can copy a part of them
+#define TRANSACTION_CHUNK_SIZE (32 * 1024 * 1024)
+
+// Files up to this size travel in batches, which together fit one read-ahead buffer
+#define TRANSACTION_SMALL_FILE_SIZE (64 * 1024)
+#define TRANSACTION_BATCH_BYTES (1024 * 1024)
+#define TRANSACTION_BATCH_MAX 64
+
+// Shared by the chunks of a split file, the last chunk to finish closes the files
+typedef struct
+{
+    int source_fd;
+    int dest_fd;
+    int chunks_left;
+    int failed;
+    pthread_mutex_t mutex;
+} SplitFile;
+
+typedef struct
+{
+    int source_fd;
+    int dest_fd;
+    off_t size; // size when the file was opened, the copy still goes to the end
+} BatchFile;
+
+// Small files that go through the buffer and a worker as one item
+typedef struct
+{
+    int count;
+    off_t bytes;
+    BatchFile files[TRANSACTION_BATCH_MAX];
+} TransactionBatch;
+
+// A whole file when file and batch are NULL, length bytes at offset of a
+// split file, or a batch of small files
 typedef struct
 {
     int source_fd;
     int dest_fd;
+    off_t offset;
+    off_t length;
+    SplitFile *file;
+    TransactionBatch *batch;
 } Transaction;
 
 void transaction_init(Transaction *transaction, int source_fd, int dest_fd);
+SplitFile *split_file_create(int source_fd, int dest_fd, int chunks);
+int transaction_finish(Transaction *transaction, int *failed);
+TransactionBatch *transaction_batch_create();
+void transaction_init_batch(Transaction *transaction, TransactionBatch *batch);
 
-#endif // TRANSACTION_H
\ No newline at end of file
+#endif // TRANSACTION_H
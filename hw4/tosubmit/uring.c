@@ -0,0 +1,389 @@
+// uring.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+// No liburing here, the ring is set up and driven with the raw system calls
+
+static int ring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int ring_register(int ring_fd, unsigned opcode, void *arg, unsigned count)
+{
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, count);
+}
+
+static int map_rings(UringCopier *copier, struct io_uring_params *params)
+{
+    copier->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    copier->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = params->features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && copier->cq_ring_size > copier->sq_ring_size)
+    {
+        copier->sq_ring_size = copier->cq_ring_size;
+    }
+
+    copier->sq_ring = mmap(NULL, copier->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, copier->ring_fd, IORING_OFF_SQ_RING);
+    if (copier->sq_ring == MAP_FAILED)
+    {
+        return -1;
+    }
+    copier->cq_ring = copier->sq_ring;
+    if (!single_mmap)
+    {
+        copier->cq_ring = mmap(NULL, copier->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, copier->ring_fd, IORING_OFF_CQ_RING);
+        if (copier->cq_ring == MAP_FAILED)
+        {
+            munmap(copier->sq_ring, copier->sq_ring_size);
+            return -1;
+        }
+    }
+
+    copier->sqes = mmap(NULL, params->sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, copier->ring_fd, IORING_OFF_SQES);
+    if (copier->sqes == MAP_FAILED)
+    {
+        if (copier->cq_ring != copier->sq_ring)
+        {
+            munmap(copier->cq_ring, copier->cq_ring_size);
+        }
+        munmap(copier->sq_ring, copier->sq_ring_size);
+        return -1;
+    }
+
+    char *sq = copier->sq_ring;
+    char *cq = copier->cq_ring;
+    copier->sq_entries = params->sq_entries;
+    copier->sq_head = (unsigned *)(sq + params->sq_off.head);
+    copier->sq_tail = (unsigned *)(sq + params->sq_off.tail);
+    copier->sq_mask = (unsigned *)(sq + params->sq_off.ring_mask);
+    copier->sq_array = (unsigned *)(sq + params->sq_off.array);
+    copier->cq_head = (unsigned *)(cq + params->cq_off.head);
+    copier->cq_tail = (unsigned *)(cq + params->cq_off.tail);
+    copier->cq_mask = (unsigned *)(cq + params->cq_off.ring_mask);
+    copier->cqes = (struct io_uring_cqe *)(cq + params->cq_off.cqes);
+    copier->tail = *copier->sq_tail;
+    return 0;
+}
+
+// Every slot has at most one request in the ring and the ring has a entry per slot, so this never runs out
+static struct io_uring_sqe *next_sqe(UringCopier *copier)
+{
+    unsigned index = copier->tail & *copier->sq_mask;
+    struct io_uring_sqe *sqe = &copier->sqes[index];
+    copier->sq_array[index] = index;
+    copier->tail++;
+    copier->to_submit++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void queue_transfer(UringCopier *copier, int slot_index)
+{
+    UringSlot *slot = &copier->slots[slot_index];
+    struct io_uring_sqe *sqe = next_sqe(copier);
+    char *buffer = copier->buffers + slot_index * copier->chunk_size;
+
+    if (slot->writing)
+    {
+        sqe->opcode = copier->fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = copier->fixed_files ? 2 * slot_index + 1 : slot->transaction.dest_fd;
+        sqe->addr = (unsigned long)(buffer + slot->written);
+        sqe->len = slot->length - slot->written;
+        sqe->off = slot->offset + slot->written;
+    }
+    else
+    {
+        sqe->opcode = copier->fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = copier->fixed_files ? 2 * slot_index : slot->transaction.source_fd;
+        sqe->addr = (unsigned long)buffer;
+        sqe->len = copier->chunk_size;
+        if (slot->end >= 0 && slot->end - slot->offset < (off_t)copier->chunk_size)
+        {
+            sqe->len = slot->end - slot->offset;
+        }
+        sqe->off = slot->offset;
+    }
+    if (copier->fixed_files)
+    {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    sqe->buf_index = slot_index;
+    sqe->user_data = slot_index;
+}
+
+int uring_copier_init(UringCopier *copier, int depth, size_t chunk_size)
+{
+    memset(copier, 0, sizeof(*copier));
+    copier->depth = depth;
+    copier->chunk_size = chunk_size;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    copier->ring_fd = ring_setup(depth, &params);
+    if (copier->ring_fd < 0)
+    {
+        return -1;
+    }
+    if (map_rings(copier, &params) < 0)
+    {
+        close(copier->ring_fd);
+        return -1;
+    }
+
+    copier->slots = calloc(depth, sizeof(UringSlot));
+    if (copier->slots == NULL || posix_memalign((void **)&copier->buffers, 4096, depth * chunk_size) != 0)
+    {
+        free(copier->slots);
+        copier->buffers = NULL;
+        copier->slots = NULL;
+        uring_copier_destroy(copier);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Registering pins the buffers and files once instead of on every request,
+    // when the kernel or the memlock limit refuses the plain requests still work
+    struct iovec *iovecs = malloc(depth * sizeof(struct iovec));
+    int *fds = malloc(2 * depth * sizeof(int));
+    if (iovecs != NULL && fds != NULL)
+    {
+        for (int i = 0; i < depth; i++)
+        {
+            iovecs[i].iov_base = copier->buffers + i * chunk_size;
+            iovecs[i].iov_len = chunk_size;
+            fds[2 * i] = -1;
+            fds[2 * i + 1] = -1;
+        }
+        copier->fixed_buffers = ring_register(copier->ring_fd, IORING_REGISTER_BUFFERS, iovecs, depth) == 0;
+        copier->fixed_files = ring_register(copier->ring_fd, IORING_REGISTER_FILES, fds, 2 * depth) == 0;
+    }
+    free(iovecs);
+    free(fds);
+    return 0;
+}
+
+// Slots still active here were never drained, they count as failed chunks and
+// their files are closed unless other chunks of a split file are still being
+// copied by other workers. Call uring_copier_drain first to report them.
+void uring_copier_destroy(UringCopier *copier)
+{
+    if (copier->sqes != NULL && copier->sqes != MAP_FAILED)
+    {
+        munmap(copier->sqes, copier->sq_entries * sizeof(struct io_uring_sqe));
+    }
+    if (copier->cq_ring != NULL && copier->cq_ring != copier->sq_ring)
+    {
+        munmap(copier->cq_ring, copier->cq_ring_size);
+    }
+    if (copier->sq_ring != NULL)
+    {
+        munmap(copier->sq_ring, copier->sq_ring_size);
+    }
+    close(copier->ring_fd);
+
+    for (int i = 0; copier->slots != NULL && i < copier->depth; i++)
+    {
+        int failed = 1;
+        if (copier->slots[i].active && transaction_finish(&copier->slots[i].transaction, &failed))
+        {
+            close(copier->slots[i].transaction.source_fd);
+            close(copier->slots[i].transaction.dest_fd);
+        }
+    }
+    free(copier->slots);
+    if (!copier->keep_buffers)
+    {
+        free(copier->buffers);
+    }
+    copier->slots = NULL;
+    copier->buffers = NULL;
+}
+
+// Queues the first read of a file, returns -1 when every slot is busy
+int uring_copier_add(UringCopier *copier, const Transaction *transaction)
+{
+    for (int i = 0; i < copier->depth; i++)
+    {
+        UringSlot *slot = &copier->slots[i];
+        if (slot->active)
+        {
+            continue;
+        }
+
+        if (copier->fixed_files)
+        {
+            int fds[2] = {transaction->source_fd, transaction->dest_fd};
+            struct io_uring_files_update update;
+            memset(&update, 0, sizeof(update));
+            update.offset = 2 * i;
+            update.fds = (unsigned long)fds;
+            if (ring_register(copier->ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 2) != 2)
+            {
+                // Requests already in the ring keep their fixed files, new ones use plain descriptors
+                copier->fixed_files = 0;
+            }
+        }
+
+        memset(slot, 0, sizeof(*slot));
+        slot->transaction = *transaction;
+        slot->offset = transaction->offset;
+        slot->end = transaction->file != NULL ? transaction->offset + transaction->length : -1;
+        slot->active = 1;
+        copier->in_flight++;
+        queue_transfer(copier, i);
+        return 0;
+    }
+    return -1;
+}
+
+static int finish_slot(UringCopier *copier, UringSlot *slot, int error, UringDone *done)
+{
+    done->transaction = slot->transaction;
+    done->copied = slot->copied;
+    done->error = error;
+    slot->active = 0;
+    copier->in_flight--;
+    return 1;
+}
+
+static int handle_completion(UringCopier *copier, struct io_uring_cqe *cqe, UringDone *done)
+{
+    if (cqe->user_data == URING_CANCEL_DATA)
+    {
+        return 0;
+    }
+    int slot_index = (int)cqe->user_data;
+    UringSlot *slot = &copier->slots[slot_index];
+    int result = cqe->res;
+
+    if (result == -EINTR || result == -EAGAIN)
+    {
+        if (copier->draining)
+        {
+            return finish_slot(copier, slot, ECANCELED, done);
+        }
+        queue_transfer(copier, slot_index);
+        return 0;
+    }
+
+    if (result < 0 || (!slot->writing && result == 0))
+    {
+        return finish_slot(copier, slot, result < 0 ? -result : 0, done);
+    }
+    // A write that moves nothing would be queued again forever
+    if (slot->writing && result == 0)
+    {
+        return finish_slot(copier, slot, EIO, done);
+    }
+
+    if (!slot->writing)
+    {
+        slot->writing = 1;
+        slot->length = result;
+        slot->written = 0;
+    }
+    else
+    {
+        slot->written += result;
+        slot->copied += result;
+        if (slot->written == slot->length)
+        {
+            slot->writing = 0;
+            slot->offset += slot->length;
+            if (slot->end >= 0 && slot->offset >= slot->end)
+            {
+                return finish_slot(copier, slot, 0, done);
+            }
+        }
+    }
+    if (copier->draining)
+    {
+        return finish_slot(copier, slot, ECANCELED, done);
+    }
+    queue_transfer(copier, slot_index);
+    return 0;
+}
+
+// Submits everything queued, waits for at least one completion and handles
+// every completion there is. Returns the number of files finished into done,
+// or -1 when the ring fails. A signal returns 0 so the caller can check stop.
+int uring_copier_complete(UringCopier *copier, UringDone *done, int max)
+{
+    __atomic_store_n(copier->sq_tail, copier->tail, __ATOMIC_RELEASE);
+    int submitted = ring_enter(copier->ring_fd, copier->to_submit, 1, IORING_ENTER_GETEVENTS);
+    if (submitted < 0)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+    copier->to_submit -= submitted;
+
+    int finished = 0;
+    unsigned head = *copier->cq_head;
+    while (finished < max && head != __atomic_load_n(copier->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe *cqe = &copier->cqes[head & *copier->cq_mask];
+        finished += handle_completion(copier, cqe, &done[finished]);
+        head++;
+    }
+    __atomic_store_n(copier->cq_head, head, __ATOMIC_RELEASE);
+    return finished;
+}
+
+// Cancels the request of every active slot and waits until the kernel is done
+// with all of them, so no read or write touches a buffer or a file after its
+// slot is reported. Every active slot ends up in done, which needs room for
+// depth entries. When the ring itself fails the slots are reported as failed
+// and the buffers are kept, since requests may still be running.
+int uring_copier_drain(UringCopier *copier, UringDone *done)
+{
+    copier->draining = 1;
+    int finished = 0;
+    int cancelled = 0;
+    while (copier->in_flight > 0)
+    {
+        // Queued transfers go in first, so the ring always has room for the cancels
+        if (!cancelled && copier->to_submit == 0)
+        {
+            for (int i = 0; i < copier->depth; i++)
+            {
+                if (copier->slots[i].active)
+                {
+                    struct io_uring_sqe *sqe = next_sqe(copier);
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->addr = i;
+                    sqe->user_data = URING_CANCEL_DATA;
+                }
+            }
+            cancelled = 1;
+        }
+
+        int got = uring_copier_complete(copier, done + finished, copier->depth - finished);
+        if (got < 0)
+        {
+            copier->keep_buffers = 1;
+            for (int i = 0; i < copier->depth; i++)
+            {
+                if (copier->slots[i].active)
+                {
+                    finished += finish_slot(copier, &copier->slots[i], EIO, &done[finished]);
+                }
+            }
+            return finished;
+        }
+        finished += got;
+    }
+    return finished;
+}
@@ -0,0 +1,74 @@
+// uring.h
+#ifndef URING_H
+#define URING_H
+
+#include <sys/types.h>
+#include <linux/io_uring.h>
+#include "transaction.h"
+
+#define URING_DEPTH 32
+#define URING_CHUNK_SIZE (256 * 1024)
+
+// user_data of the cancel requests, slots use their index
+#define URING_CANCEL_DATA ((__u64)-1)
+
+// One file being copied, it has at most one read or write in the ring
+typedef struct
+{
+    Transaction transaction;
+    int active;
+    int writing;
+    off_t offset; // file offset of the chunk in the buffer
+    off_t end;    // end of the range to copy, -1 for the whole file
+    unsigned length;
+    unsigned written;
+    long long copied;
+} UringSlot;
+
+typedef struct
+{
+    Transaction transaction;
+    long long copied;
+    int error; // errno of the failed read or write, 0 when copied
+} UringDone;
+
+// Copies up to depth files at once from one thread. Each slot has its own
+// registered buffer and two registered files, so reads and writes go in as
+// READ_FIXED and WRITE_FIXED on fixed files when the kernel allows it.
+typedef struct
+{
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_sqe *sqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    unsigned tail;
+    unsigned to_submit;
+    UringSlot *slots;
+    int depth;
+    int in_flight;
+    char *buffers;
+    size_t chunk_size;
+    int fixed_buffers;
+    int fixed_files;
+    int draining;      // completions finish their slot instead of queuing the next transfer
+    int keep_buffers;  // the ring could not be drained, requests may still use the buffers
+} UringCopier;
+
+int uring_copier_init(UringCopier *copier, int depth, size_t chunk_size);
+void uring_copier_destroy(UringCopier *copier);
+int uring_copier_add(UringCopier *copier, const Transaction *transaction);
+int uring_copier_complete(UringCopier *copier, UringDone *done, int max);
+int uring_copier_drain(UringCopier *copier, UringDone *done);
+
+#endif // URING_H
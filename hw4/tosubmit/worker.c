@@ -1,30 +1,167 @@
 // worker.c
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <signal.h>
 #include <pthread.h>
+#include <fcntl.h>
 #include "buffer.h"
 #include "transaction.h"
 #include "thread_args.h"
 #include "stats.h"
-
-#define BUFFER_SIZE 4096
+#include "copy.h"
+#include "uring.h"
 
 extern volatile sig_atomic_t stop;
 extern pthread_barrier_t barrier;
 
-void *worker_function(void *arg)
+// Closes the files once every chunk of them is copied, a whole file is always done.
+// The engine of the chunk that finishes a file is the one it is counted under.
+static void finish_transaction(Stats *stats, Transaction *transaction, int failed, int engine)
 {
-    WorkerThreadArgs *args = (WorkerThreadArgs *)arg;
-    Buffer *buffer = args->buffer;
-    Stats *stats = args->stats;
-    char buf[BUFFER_SIZE];
+    if (transaction_finish(transaction, &failed))
+    {
+        close(transaction->source_fd);
+        close(transaction->dest_fd);
 
-    printf("Worker %ld initialized. Waiting for other workers to initalize...\n", pthread_self());
-    pthread_barrier_wait(&barrier);
-    printf("Worker %ld starting to copy files\n", pthread_self());
+        stats_increment_regular_files(stats);
+        if (!failed)
+        {
+            stats_increment_engine(stats, engine);
+        }
+    }
+}
+
+// Reads a small file whole with one read in the usual case. It asks for a
+// byte more than size, so a file that grew since it was opened shows up as
+// size + 1 without another read to find the end. It always reads once, so
+// a file that was empty when opened is checked for growth too.
+static ssize_t read_small_file(int fd, char *data, size_t size)
+{
+    size_t done = 0;
+    do
+    {
+        ssize_t bytes = read(fd, data + done, size + 1 - done);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes == 0)
+        {
+            break;
+        }
+        done += bytes;
+    } while (done < size);
+    return done;
+}
+
+static int write_full(int fd, const char *data, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t bytes = write(fd, data + done, len - done);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        done += bytes;
+    }
+    return 0;
+}
 
+// Small files are read one after another into the copy buffer and only then
+// written out. Every source is advised first, so the kernel reads ahead the
+// whole batch while the first files are copied. Everything staged is written
+// before any file goes through copy_file, which reuses the buffer.
+static void copy_batch(TransactionBatch *batch, Stats *stats, CopyContext *copy)
+{
+    off_t starts[TRANSACTION_BATCH_MAX];
+    ssize_t lengths[TRANSACTION_BATCH_MAX];
+    off_t used = 0;
+    for (int i = 0; i < batch->count; i++)
+    {
+        posix_fadvise(batch->files[i].source_fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+
+    for (int i = 0; i < batch->count; i++)
+    {
+        BatchFile *file = &batch->files[i];
+        starts[i] = -1;
+        // The extra byte may run into the next file's room, it is never written
+        if (used + file->size + 1 <= (off_t)copy->buffer_size)
+        {
+            starts[i] = used;
+            lengths[i] = read_small_file(file->source_fd, copy->buffer + used, file->size);
+            used += file->size;
+        }
+    }
+
+    ssize_t copied[TRANSACTION_BATCH_MAX];
+    for (int i = 0; i < batch->count; i++)
+    {
+        BatchFile *file = &batch->files[i];
+        copied[i] = -1;
+        if (starts[i] >= 0 && lengths[i] >= 0)
+        {
+            // A file that grew since it was opened gets its snapshot here and the rest below
+            ssize_t staged = lengths[i] > file->size ? file->size : lengths[i];
+            if (write_full(file->dest_fd, copy->buffer + starts[i], staged) == 0)
+            {
+                copied[i] = staged;
+            }
+        }
+    }
+
+    long long bytes = 0;
+    int engine_files[COPY_ENGINE_COUNT] = {0};
+    for (int i = 0; i < batch->count; i++)
+    {
+        BatchFile *file = &batch->files[i];
+        int engine = COPY_ENGINE_READ_WRITE;
+        if (starts[i] < 0)
+        {
+            // No room was left in the copy buffer when its turn came
+            copied[i] = copy_file(copy, file->source_fd, file->dest_fd);
+            engine = copy->last_engine;
+        }
+        else if (copied[i] >= 0 && lengths[i] > file->size)
+        {
+            ssize_t rest = lseek(file->source_fd, file->size, SEEK_SET) < 0 ? -1 : copy_file(copy, file->source_fd, file->dest_fd);
+            copied[i] = rest < 0 ? -1 : copied[i] + rest;
+            engine = copy->last_engine;
+        }
+
+        if (copied[i] < 0)
+        {
+            perror("Failed to copy file");
+        }
+        else
+        {
+            bytes += copied[i];
+            engine_files[engine]++;
+        }
+        close(file->source_fd);
+        close(file->dest_fd);
+    }
+
+    stats_add_batch(stats, batch->count, bytes, engine_files);
+    free(batch);
+}
+
+// One file or chunk at a time through copy_file and copy_range
+static void copy_files(Buffer *buffer, Stats *stats, CopyContext *copy)
+{
     while (!stop)
     {
         Transaction transaction = buffer_get(buffer);
@@ -36,19 +173,159 @@ void *worker_function(void *arg)
             break;
         }
 
-        ssize_t bytes_read;
-        while ((bytes_read = read(src_fd, buf, sizeof(buf))) > 0)
+        if (transaction.batch != NULL)
+        {
+            copy_batch(transaction.batch, stats, copy);
+            continue;
+        }
+
+        ssize_t copied;
+        if (transaction.file != NULL)
+        {
+            copied = copy_range(copy, src_fd, dest_fd, transaction.offset, transaction.length);
+        }
+        else
+        {
+            copied = copy_file(copy, src_fd, dest_fd);
+        }
+        if (copied < 0)
+        {
+            perror("Failed to copy file");
+        }
+        else
         {
-            write(dest_fd, buf, bytes_read);
-            stats_increment_bytes(stats, bytes_read);
+            stats_increment_bytes(stats, copied);
         }
 
-        close(src_fd);
-        close(dest_fd);
+        finish_transaction(stats, &transaction, copied < 0, copy->last_engine);
+    }
+}
 
-        stats_increment_regular_files(stats);
+static void report_uring_done(Stats *stats, UringDone *done, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (done[i].error != 0)
+        {
+            errno = done[i].error;
+            perror("Failed to copy file");
+        }
+        else
+        {
+            stats_increment_bytes(stats, done[i].copied);
+        }
+
+        finish_transaction(stats, &done[i].transaction, done[i].error != 0, COPY_ENGINE_URING);
+    }
+}
+
+// Keeps up to the ring depth files in flight. It only waits for the manager
+// when nothing is in flight, otherwise it takes what is there and goes back
+// to the ring. Batches of small files are copied right away with copy.
+// Returns -1 when the ring fails.
+static int copy_files_with_uring(Buffer *buffer, Stats *stats, UringCopier *copier, CopyContext *copy)
+{
+    UringDone *done = malloc(copier->depth * sizeof(UringDone));
+    if (done == NULL)
+    {
+        return -1;
+    }
+
+    int closed = 0;
+    int failed = 0;
+    while (!stop && (!closed || copier->in_flight > 0))
+    {
+        while (!closed && copier->in_flight < copier->depth)
+        {
+            Transaction transaction;
+            if (copier->in_flight == 0)
+            {
+                transaction = buffer_get(buffer);
+                closed = transaction.source_fd == -1 && transaction.dest_fd == -1;
+            }
+            else
+            {
+                int got = buffer_try_get(buffer, &transaction);
+                closed = got < 0;
+                if (got <= 0)
+                {
+                    break;
+                }
+            }
+            if (closed)
+            {
+                break;
+            }
+            if (transaction.batch != NULL)
+            {
+                copy_batch(transaction.batch, stats, copy);
+                continue;
+            }
+            uring_copier_add(copier, &transaction);
+        }
+        if (copier->in_flight == 0)
+        {
+            continue;
+        }
+
+        int finished = uring_copier_complete(copier, done, copier->depth);
+        if (finished < 0)
+        {
+            perror("io_uring failed");
+            failed = 1;
+            break;
+        }
+        report_uring_done(stats, done, finished);
+    }
+
+    // After a stop or a ring failure the files still in the ring are cancelled and reported as failed
+    report_uring_done(stats, done, uring_copier_drain(copier, done));
+    free(done);
+    return failed ? -1 : 0;
+}
+
+void *worker_function(void *arg)
+{
+    WorkerThreadArgs *args = (WorkerThreadArgs *)arg;
+    Buffer *buffer = args->buffer;
+    Stats *stats = args->stats;
+    CopyContext copy;
+    if (copy_context_init(&copy, args->engine, COPY_BUFFER_SIZE) < 0)
+    {
+        perror("Failed to allocate copy buffer");
+        exit(EXIT_FAILURE);
+    }
+
+    UringCopier copier;
+    int use_uring = args->engine == COPY_ENGINE_URING;
+    if (use_uring && uring_copier_init(&copier, args->uring_depth, URING_CHUNK_SIZE) < 0)
+    {
+        perror("Failed to set up io_uring, copying one file at a time");
+        use_uring = 0;
     }
 
+    printf("Worker %ld initialized. Waiting for other workers to initalize...\n", pthread_self());
+    pthread_barrier_wait(&barrier);
+    printf("Worker %ld starting to copy files\n", pthread_self());
+
+    if (use_uring)
+    {
+        // Files in the ring when it fails are reported as failed, the rest are copied one at a time.
+        // The ring goes first, so its chunks are finished before the fallback runs.
+        int failed = copy_files_with_uring(buffer, stats, &copier, &copy) < 0;
+        uring_copier_destroy(&copier);
+        if (failed)
+        {
+            copy_files(buffer, stats, &copy);
+        }
+    }
+    else
+    {
+        copy_files(buffer, stats, &copy);
+    }
+
+    copy_context_destroy(&copy);
+
     if (stop)
     {
         printf("Worker %ld interrupted\n", pthread_self());